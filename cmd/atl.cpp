@@ -62,14 +62,18 @@ bool atl_load_atlas(std::string atlas_name,std::vector<std::shared_ptr<atlas> >&
 }
 
 void atl_save_mapping(std::vector<std::shared_ptr<atlas> >& atlas_list,
-                      const std::string& file_name,const tipl::geometry<3>& geo,
-                      const tipl::image<tipl::vector<3>,3>& mapping,
-                      const tipl::matrix<4,4,float>& trans,
-                      const tipl::vector<3>& vs,
+                      const std::string& file_name,
+                      std::shared_ptr<fib_data> handle,
                       bool multiple)
 {
     for(unsigned int i = 0;i < atlas_list.size();++i)
     {
+        auto label_map = handle->get_atlas_label_map(atlas_list[i]);
+        if(!label_map)
+        {
+            std::cout << handle->error_msg << std::endl;
+            continue;
+        }
         std::string base_name = file_name;
         base_name += ".";
         base_name += atlas_list[i]->name;
@@ -80,15 +84,13 @@ void atl_save_mapping(std::vector<std::shared_ptr<atlas> >& atlas_list,
             output += atlas_list[i]->get_list()[j];
             output += ".nii.gz";
 
-            tipl::image<unsigned char,3> roi(geo);
-            for(unsigned int k = 0;k < mapping.size();++k)
-                if (atlas_list[i]->is_labeled_as(mapping[k], j))
-                    roi[k] = 1;
+            tipl::image<unsigned char,3> roi(handle->dim);
+            label_map->for_each_voxel(short(j),[&](unsigned int k){roi[k] = 1;});
             if(multiple)
             {
                 tipl::io::nifti out;
-                out.set_voxel_size(vs);
-                out.set_LPS_transformation(trans,roi.geometry());
+                out.set_voxel_size(handle->vs);
+                out.set_LPS_transformation(handle->trans_to_mni,roi.geometry());
                 tipl::flip_xy(roi);
                 out << roi;
                 out.save_to_file(output.c_str());
@@ -219,9 +221,7 @@ int atl(void)
             std::cout << "Cannot output connectivity: no mni mapping" << std::endl;
             return 1;
         }
-        atl_save_mapping(atlas_list,
-                         po.get("source"),handle->dim,
-                         handle->get_mni_mapping(),handle->trans_to_mni,handle->vs,
+        atl_save_mapping(atlas_list,po.get("source"),handle,
                          po.get("output","multiple") == "multiple");
         return 0;
     }
@@ -116,6 +116,12 @@ int cnt(void)
         vbc->ui->normalize_qa->setChecked(true);
     }
 
+    if(po.get("voxel_major",int(0)))
+    {
+        std::cout << "voxel_major=1" << std::endl;
+        vbc->vbc->voxel_major = true;
+    }
+
     if(po.has("fdr_threshold"))
     {
         vbc->ui->rb_fdr->setChecked(true);
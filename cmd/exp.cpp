@@ -35,7 +35,7 @@ int exp(void)
         return 1;
     }
 
-    gz_mat_read mat_reader;
+    gz_mat_lazy_read mat_reader;
     std::string file_name = po.get("source");
     std::cout << "loading " << file_name << "..." <<std::endl;
     if(!QFileInfo(file_name.c_str()).exists())
@@ -27,12 +27,23 @@ int rec(void)
     std::string file_name = po.get("source");
     std::cout << "loading source..." <<std::endl;
     std::auto_ptr<ImageModel> handle(new ImageModel);
+    handle->max_memory = po.get("max_memory",int(0));
     if (!handle->load_from_file(file_name.c_str()))
     {
         std::cout << "Load src file failed:" << handle->error_msg << std::endl;
         return 1;
     }
     std::cout << "src loaded" <<std::endl;
+    if(handle->src_stream.get())
+    {
+        std::cout << "SRC file exceeds max_memory. DWI will be streamed in slabs." << std::endl;
+        std::cout << "max_memory bounds only the DWI input. The reconstructed maps and ODFs are held in memory until the fib file is saved." << std::endl;
+        if(po.has("other_src") || po.has("cmd") || po.has("affine") || po.has("rotate_to") || po.get("motion_correction",int(0)))
+        {
+            std::cout << "Image operations are not supported in the streaming mode. Increase max_memory." << std::endl;
+            return 1;
+        }
+    }
     if(po.has("other_src"))
     {
         std::string file_name2 = po.get("other_src");
@@ -163,6 +174,11 @@ int rec(void)
     handle->voxel.ti.init(po.get("odf_order",int(8)));
     handle->voxel.odf_resolving = po.get("odf_resolving",int(0));
     handle->voxel.output_odf = po.get("record_odf",int(0));
+    {
+        int odf_bits = po.get("odf_bits",int(0));
+        if(odf_bits == 8 || odf_bits == 16)
+            handle->voxel.odf_bits = odf_bits;
+    }
     handle->voxel.check_btable = po.get("check_btable",int(1));
     handle->voxel.output_jacobian = po.get("output_jac",int(0));
     handle->voxel.output_mapping = po.get("output_map",int(0));
@@ -173,6 +189,8 @@ int rec(void)
     handle->voxel.r2_weighted = po.get("r2_weighted",int(0));
     handle->voxel.csf_calibration = po.get("csf_calibration",int(0)) && method_index == 4;
     handle->voxel.thread_count = po.get("thread_count",int(std::thread::hardware_concurrency()));
+    handle->voxel.block_size = po.get("block_size",int(handle->voxel.block_size));
+    handle->voxel.sinc_lookup = po.get("sinc_lookup",int(1));
 
 
 
@@ -262,6 +280,9 @@ int rec(void)
         rec_motion_correction(handle.get());
         std::cout << "Done." <<std::endl;
     }
+    if(handle->src_stream.get())
+        std::cout << "estimated output size: " << handle->output_size()/(1024*1024) << " MB. DWI will be streamed "
+                  << handle->slab_thickness() << " slices at a time" << std::endl;
     std::cout << "start reconstruction..." <<std::endl;
     const char* msg = handle->reconstruction();
     if (!msg)
@@ -144,8 +144,12 @@ int src(void)
         return 1;
     }
     std::cout << "Output src to " << output << std::endl;
-    DwiHeader::output_src(output.c_str(),dwi_files,
+    if(!DwiHeader::output_src(output.c_str(),dwi_files,
                           po.get<int>("up_sampling",0),
-                          po.get<int>("sort_b_table",0));
+                          po.get<int>("sort_b_table",0)))
+    {
+        std::cout << "Cannot save src file to " << output << std::endl;
+        return 1;
+    }
     return 0;
 }
@@ -128,7 +128,7 @@ void get_connectivity_matrix(std::shared_ptr<fib_data> handle,
                 }
                 std::vector<std::shared_ptr<atlas> > atlas_list;
                 if(atl_load_atlas(roi_file_name,atlas_list))
-                    data.set_atlas(atlas_list[0],handle->get_mni_mapping());
+                    data.set_atlas(atlas_list[0],handle);
                 else
                 {
                     std::cout << "File or atlas does not exist:" << roi_file_name << std::endl;
@@ -248,18 +248,17 @@ bool load_region(std::shared_ptr<fib_data> handle,
             std::cout << "Please assign region name of an atlas." << std::endl;
             return false;
         }
-        const tipl::image<tipl::vector<3,float>,3 >& mapping = handle->get_mni_mapping();
         std::cout << "Loading " << region_name << " from " << file_name << " atlas" << std::endl;
-        tipl::vector<3> null;
         std::vector<tipl::vector<3,short> > cur_region;
         for(unsigned int i = 0;i < atlas_list.size();++i)
             if(atlas_list[i]->name == file_name)
                 for (unsigned int label_index = 0; label_index < atlas_list[i]->get_list().size(); ++label_index)
                     if(atlas_list[i]->get_list()[label_index] == region_name)
                 {
-                    for (tipl::pixel_index<3>index(mapping.geometry());index < mapping.size();++index)
-                        if(mapping[index.index()] != null && atlas_list[i]->is_labeled_as(mapping[index.index()],label_index))
-                            cur_region.push_back(tipl::vector<3,short>(index.begin()));
+                    float r = 1.0f;
+                    std::vector<tipl::vector<3,short> > points;
+                    handle->get_atlas_roi(atlas_list[i],label_index,points,r);
+                    cur_region.insert(cur_region.end(),points.begin(),points.end());
                 }
         roi.add_points(cur_region,false);
     }
@@ -652,7 +651,7 @@ int trk(std::shared_ptr<fib_data> handle)
                               << ". Please check write permission, directory, and disk space." << std::endl;
                     return 1;
                 }
-                std::vector<std::vector<float> > tmp;
+                tract_arena tmp;
                 tract_model.release_tracts(tmp);
             }
         }
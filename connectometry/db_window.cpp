@@ -491,7 +491,7 @@ void db_window::on_actionAdd_DB_triggered()
 
         if(handle->db.has_db())
         {
-            if(!vbc->handle->db.add_db(handle->db))
+            if(!handle->db.load_subject_qa() || !vbc->handle->db.add_db(handle->db))
             {
                 QMessageBox::information(this,"Error",vbc->handle->error_msg.c_str(),0);
                 break;
@@ -563,7 +563,7 @@ void group_connectometry::on_show_result_clicked()
         result_fib.reset(new connectometry_result);
         stat_model info;
         info.resample(cur_model,false,false);
-        vbc->calculate_spm(*result_fib.get(),info,vbc->normalize_qa);
+        vbc->calculate_spm(*result_fib.get(),info,vbc->normalize_qa,std::thread::hardware_concurrency());
         new_data->view_item.push_back(item());
         new_data->view_item.back().name = "dec_t";
         new_data->view_item.back().image_data = tipl::make_image(result_fib->neg_corr_ptr[0],new_data->dim);
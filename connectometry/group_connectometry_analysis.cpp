@@ -34,6 +34,11 @@ bool group_connectometry_analysis::load_database(const char* database_name)
         error_msg += handle->error_msg;
         return false;
     }
+    if(!handle->db.load_subject_qa())
+    {
+        error_msg = handle->error_msg;
+        return false;
+    }
     fiber_threshold = 0.6*tipl::segmentation::otsu_threshold(tipl::make_image(handle->dir.fa[0],handle->dim));
     if(handle->is_human_data)
     {
@@ -45,7 +50,7 @@ bool group_connectometry_analysis::load_database(const char* database_name)
 }
 
 
-int group_connectometry_analysis::run_track(const tracking_data& fib,std::vector<std::vector<float> >& tracks,int seed_count, unsigned int thread_count)
+int group_connectometry_analysis::run_track(const tracking_data& fib,tract_arena& tracks,int seed_count, unsigned int thread_count)
 {
     ThreadData tracking_thread;
     tracking_thread.param.threshold = tracking_threshold;
@@ -63,7 +68,8 @@ int group_connectometry_analysis::run_track(const tracking_data& fib,std::vector
     tracking_thread.param.termination_count = seed_count;
     tracking_thread.roi_mgr = roi_mgr;
     tracking_thread.run(fib,thread_count,true);
-    tracking_thread.track_buffer.swap(tracks);
+    tracks.clear();
+    tracking_thread.fetchTracks(tracks);
 
     if(track_trimming)
     {
@@ -71,12 +77,12 @@ int group_connectometry_analysis::run_track(const tracking_data& fib,std::vector
         t.add_tracts(tracks);
         for(int i = 0;i < track_trimming && t.get_visible_track_count();++i)
             t.trim();
-        tracks.swap(t.get_tracts());
+        t.release_tracts(tracks);
     }
     return tracks.size();
 }
 
-void cal_hist(const std::vector<std::vector<float> >& track,std::vector<unsigned int>& dist)
+void cal_hist(const tract_arena& track,std::vector<unsigned int>& dist)
 {
     for(unsigned int j = 0; j < track.size();++j)
     {
@@ -91,102 +97,95 @@ void cal_hist(const std::vector<std::vector<float> >& track,std::vector<unsigned
     }
 }
 
-void group_connectometry_analysis::run_permutation_multithread(unsigned int id,unsigned int thread_count,unsigned int permutation_count)
+void group_connectometry_analysis::run_permutation_batch(unsigned int thread_count,unsigned int permutation_count)
 {
-    connectometry_result data;
-    tracking_data fib;
-    fib.read(*handle);
-    std::vector<std::vector<float> > tracks;
     const int max_visible_track = 1000000;
+    // each permutation has four maps: null and actual resampling, negative and positive correlation
+    unsigned int batch_size = std::max<unsigned int>(permutation_batch_size,(thread_count+3)/4);
+    std::vector<tracking_data> fib(thread_count);
+    std::vector<connectometry_result> data(thread_count);
+    for(unsigned int i = 0;i < thread_count;++i)
+        fib[i].read(*handle);
+    for(unsigned int from = 0;from < permutation_count && !terminated;from += batch_size)
     {
-        bool null = true;
-        for(int i = id;i < permutation_count && !terminated;)
+        unsigned int to = std::min<unsigned int>(from+batch_size,permutation_count);
+        std::vector<stat_model> info((to-from)*4);
+        std::vector<stat_model*> info_ptr(info.size());
+        for(unsigned int k = 0;k < info.size();++k)
         {
-
-            stat_model info;
-            info.resample(*model.get(),null,true);
-            calculate_spm(data,info,normalize_qa);
-
-            fib.fa = data.neg_corr_ptr;
-            unsigned int s = run_track(fib,tracks,seed_count);
-            if(null)
-                seed_neg_corr_null[i] = s;
-            else
-                seed_neg_corr[i] = s;
-
-            cal_hist(tracks,(null) ? subject_neg_corr_null : subject_neg_corr);
-
-            if(output_resampling && !null)
+            bool null = (k & 2) == 0;
+            info[k].resample(*model.get(),null,true);
+            info_ptr[k] = &info[k];
+        }
+        // all resampled models are evaluated in one pass over the subject data
+        std::vector<std::vector<float> > spm;
+        ::calculate_spm(handle,info_ptr,spm,fiber_threshold,normalize_qa,terminated,thread_count);
+        if(terminated)
+            return;
+        tipl::par_for2(spm.size(),[&](unsigned int k,unsigned int id)
+        {
+            if(terminated)
+                return;
+            unsigned int i = from + k/4;
+            bool null = (k & 2) == 0;
+            bool pos_corr = (k & 1);
+            data[id].set_spm(handle,spm[k],pos_corr,!pos_corr);
+            fib[id].fa = pos_corr ? data[id].pos_corr_ptr : data[id].neg_corr_ptr;
+            tract_arena tracks;
+            unsigned int s = run_track(fib[id],tracks,seed_count);
+            std::vector<unsigned int> hist(subject_pos_corr.size());
+            cal_hist(tracks,hist);
             {
-                std::lock_guard<std::mutex> lock(lock_neg_corr_tracks);
-                if(tracks.size() > max_visible_track/permutation_count)
-                    tracks.resize(max_visible_track/permutation_count);
-                neg_corr_track->add_tracts(tracks,length_threshold);
-                if(id == 1)
-                {
-                    neg_corr_track->delete_repeated(1.0f);
-                    neg_corr_track->clear_deleted();
-                }
-                tracks.clear();
+                std::lock_guard<std::mutex> lock(lock_resampling);
+                if(pos_corr)
+                    (null ? seed_pos_corr_null : seed_pos_corr)[i] = s;
+                else
+                    (null ? seed_neg_corr_null : seed_neg_corr)[i] = s;
+                std::vector<unsigned int>& dist = pos_corr ? (null ? subject_pos_corr_null : subject_pos_corr) :
+                                                             (null ? subject_neg_corr_null : subject_neg_corr);
+                tipl::add(dist.begin(),dist.end(),hist.begin());
             }
-
-            info.resample(*model.get(),null,true);
-            calculate_spm(data,info,normalize_qa);
-            fib.fa = data.pos_corr_ptr;
-            s = run_track(fib,tracks,seed_count);
-            if(null)
-                seed_pos_corr_null[i] = s;
-            else
-                seed_pos_corr[i] = s;
-            cal_hist(tracks,(null) ? subject_pos_corr_null : subject_pos_corr);
-
             if(output_resampling && !null)
             {
-                std::lock_guard<std::mutex> lock(lock_pos_corr_tracks);
+                std::lock_guard<std::mutex> lock(pos_corr ? lock_pos_corr_tracks : lock_neg_corr_tracks);
+                std::shared_ptr<TractModel> track = pos_corr ? pos_corr_track : neg_corr_track;
                 if(tracks.size() > max_visible_track/permutation_count)
                     tracks.resize(max_visible_track/permutation_count);
-                pos_corr_track->add_tracts(tracks,length_threshold);
+                track->add_tracts(tracks,length_threshold);
                 if(id == 1)
                 {
-                    pos_corr_track->delete_repeated(1.0f);
-                    pos_corr_track->clear_deleted();
+                    track->delete_repeated(1.0f);
+                    track->clear_deleted();
                 }
-                tracks.clear();
             }
+        },thread_count);
+        progress = to*100/permutation_count;
+    }
+    if(terminated)
+        return;
+    {
+        stat_model info;
+        info.resample(*model.get(),false,false);
+        ::calculate_spm(handle,*spm_map.get(),info,fiber_threshold,normalize_qa,terminated,thread_count);
 
-            if(!null)
-            {
-                i += thread_count;
-                if(id == 0)
-                    progress = i*100/permutation_count;
-            }
-            null = !null;
-        }
-        if(id == 0)
+        if(terminated)
+            return;
+        if(!output_resampling)
         {
-            stat_model info;
-            info.resample(*model.get(),false,false);
-            calculate_spm(*spm_map.get(),info,normalize_qa);
-
-            if(terminated)
-                return;
-            if(!output_resampling)
-            {
-                fib.fa = spm_map->neg_corr_ptr;
-                run_track(fib,tracks,seed_count*permutation_count,threads.size());
-                if(tracks.size() > max_visible_track)
-                    tracks.resize(max_visible_track);
-                neg_corr_track->add_tracts(tracks,length_threshold);
-                fib.fa = spm_map->pos_corr_ptr;
-                run_track(fib,tracks,seed_count*permutation_count,threads.size());
-                if(tracks.size() > max_visible_track)
-                    tracks.resize(max_visible_track);
-                pos_corr_track->add_tracts(tracks,length_threshold);
-            }
+            tract_arena tracks;
+            fib[0].fa = spm_map->neg_corr_ptr;
+            run_track(fib[0],tracks,seed_count*permutation_count,thread_count);
+            if(tracks.size() > max_visible_track)
+                tracks.resize(max_visible_track);
+            neg_corr_track->add_tracts(tracks,length_threshold);
+            fib[0].fa = spm_map->pos_corr_ptr;
+            run_track(fib[0],tracks,seed_count*permutation_count,thread_count);
+            if(tracks.size() > max_visible_track)
+                tracks.resize(max_visible_track);
+            pos_corr_track->add_tracts(tracks,length_threshold);
         }
     }
-    if(id == 0 && !terminated)
-        progress = 100;
+    progress = 100;
 }
 void group_connectometry_analysis::clear(void)
 {
@@ -286,7 +285,7 @@ void group_connectometry_analysis::save_tracks_files(void)
                 std::string name = handle->mat_reader.name(i);
                 if(name == "dimension" || name == "voxel_size" ||
                         name == "odf_vertices" || name == "odf_faces" || name == "trans")
-                    mat_write.write(handle->mat_reader[i]);
+                    handle->mat_reader.write_to(mat_write,i);
                 if(name == "fa0")
                     mat_write.write("qa_map",handle->dir.fa[0],1,handle->dim.size());
             }
@@ -412,6 +411,9 @@ void group_connectometry_analysis::run_permutation(unsigned int thread_count,uns
 
     model->rand_gen.reset();
     std::srand(0);
+    // every permutation reads all voxels, and a voxel-major copy makes the reads contiguous
+    if(voxel_major)
+        handle->db.build_voxel_major();
 
     has_pos_corr_result = true;
     has_neg_corr_result = true;
@@ -423,9 +425,8 @@ void group_connectometry_analysis::run_permutation(unsigned int thread_count,uns
     spm_map = std::make_shared<connectometry_result>();
 
     progress = 0;
-    for(unsigned int index = 0;index < thread_count;++index)
-        threads.push_back(std::make_shared<std::future<void> >(std::async(std::launch::async,
-            [this,index,thread_count,permutation_count](){run_permutation_multithread(index,thread_count,permutation_count);})));
+    threads.push_back(std::make_shared<std::future<void> >(std::async(std::launch::async,
+        [this,thread_count,permutation_count](){run_permutation_batch(thread_count,permutation_count);})));
 }
 void group_connectometry_analysis::calculate_FDR(void)
 {
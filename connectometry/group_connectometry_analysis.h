@@ -33,12 +33,12 @@ public:// database information
     bool normalize_qa;
     bool output_resampling;
 public:
-    void calculate_spm(connectometry_result& data,stat_model& info,bool nqa)
+    void calculate_spm(connectometry_result& data,stat_model& info,bool nqa,unsigned int thread_count = 1)
     {
-        ::calculate_spm(handle,data,info,fiber_threshold,nqa,terminated);
+        ::calculate_spm(handle,data,info,fiber_threshold,nqa,terminated,thread_count);
     }
 private: // single subject analysis result
-    int run_track(const tracking_data& fib,std::vector<std::vector<float> >& track,
+    int run_track(const tracking_data& fib,tract_arena& track,
                   int seed_count,unsigned int thread_count = 1);
 public:// for FDR analysis
     std::vector<std::shared_ptr<std::future<void> > > threads;
@@ -75,7 +75,9 @@ public:// Multiple regression
     float length_threshold,fdr_threshold;
     unsigned int track_trimming;
     std::string foi_str;
-    void run_permutation_multithread(unsigned int id,unsigned int thread_count,unsigned int permutation_count);
+    unsigned int permutation_batch_size = 8; // permutations evaluated in one pass over the subject data
+    bool voxel_major = false; // keep a voxel-major copy of the subject data, which doubles its memory
+    void run_permutation_batch(unsigned int thread_count,unsigned int permutation_count);
     void run_permutation(unsigned int thread_count,unsigned int permutation_count);
     void calculate_FDR(void);
     void generate_report(std::string& output);
@@ -28,6 +28,7 @@ nn_connectometry::nn_connectometry(QWidget *parent,std::shared_ptr<fib_data> han
 
     ui->network_view->setScene(&network_scene);
     ui->layer_view->setScene(&layer_scene);
+    ui->thread_count->setValue(int(nna.thread_count));
     log_text += nna.handle->report.c_str();
     log_text += "\r\n";
     ui->log->setText(log_text);
@@ -84,6 +85,7 @@ void nn_connectometry::on_run_clicked()
     nna.otsu = ui->otsu->value();
     nna.cv_fold = ui->cv->value();
     nna.normalize_value = ui->norm_output->isEnabled() && ui->norm_output->isChecked();
+    nna.thread_count = ui->thread_count->value();
     //nna.t.error_table.resize(nna.nn.get_output_size()*nna.nn.get_output_size());
     if(!nna.run(ui->network_text->text().toStdString()))
     {
@@ -59,6 +59,44 @@ void nn_connectometry_analysis::clear_results(void)
     result_test_miss.clear();
     result_test_error.clear();
     result_train_error.clear();
+    fold_test_result.clear();
+    fold_done.clear();
+    round_count = 0;
+}
+// called with lock_result held
+void nn_connectometry_analysis::end_fold(size_t fold)
+{
+    fold_done[fold] = 1;
+    while(size_t(cur_fold)+1 < fold_done.size() && fold_done[size_t(cur_fold)])
+        ++cur_fold;
+    test_seq = test_data[size_t(cur_fold)].pos;
+    test_result = fold_test_result[size_t(cur_fold)];
+
+    // pool the finished folds in fold order so that the summary does not
+    // depend on which fold finishes first
+    all_test_seq.clear();
+    all_test_result.clear();
+    for(size_t i = 0;i < fold_done.size();++i)
+        if(fold_done[i])
+        {
+            all_test_seq.insert(all_test_seq.end(),test_data[i].pos.begin(),test_data[i].pos.end());
+            all_test_result.insert(all_test_result.end(),fold_test_result[i].begin(),fold_test_result[i].end());
+        }
+    std::vector<float> y(all_test_result.size());
+    float all_mae = 0.0f,all_accuracy = 0.0f;
+    for(int i = 0;i < y.size();++i)
+    {
+        y[i] = fp_data.data_label[all_test_seq[i]];
+        all_mae += std::fabs(y[i]-all_test_result[i]);
+        all_accuracy += (std::round(y[i]) == std::round(all_test_result[i]) ? 1.0f:0.0f);
+    }
+
+    std::ostringstream out;
+    out << " " << cv_fold << " fold cross validation results shows that"
+        << " r=" << tipl::correlation(y.begin(),y.end(),all_test_result.begin())
+        << ", mae=" << all_mae/(float)y.size()
+        << ", accuracy = " << (int)all_accuracy << "/" << y.size() << " = " << 100.0f*(float)all_accuracy/(float)y.size() << "%.";
+    all_result = out.str();
 }
 bool nn_connectometry_analysis::run(const std::string& net_string_)
 {
@@ -201,45 +239,55 @@ bool nn_connectometry_analysis::run(const std::string& net_string_)
     cur_progress = 0;
     cur_fold = 0;
     terminated = false;
+    clear_results();
+    result_r.resize(cv_fold);
+    result_mae.resize(cv_fold);
+    result_test_miss.resize(cv_fold);
+    result_test_error.resize(cv_fold);
+    result_train_error.resize(cv_fold);
+    fold_test_result.resize(cv_fold);
+    fold_done.resize(cv_fold);
 
     future = std::async(std::launch::async, [this,net_string]
     {
-        for(size_t fold = 0;fold < cv_fold && !terminated;++fold)
+        unsigned int fold_thread_count = std::max<unsigned int>(1,std::min<unsigned int>(thread_count,cv_fold));
+        unsigned int inner_thread_count = std::max<unsigned int>(1,thread_count/fold_thread_count);
+        tipl::par_for2(cv_fold,[&](unsigned int fold,unsigned int)
         {
-            cur_fold = fold;
-            clear_results();
+            if(terminated)
+                return;
             std::cout << "running cross validation at fold=" << fold << std::endl;
-            test_seq = test_data[fold].pos;
+            // fold 0 trains nn so that the network and layer views follow it
+            tipl::ml::network fold_nn;
+            tipl::ml::network& cur_nn = fold ? fold_nn : nn;
             if(fold)
-            {
-                std::cout << "re-initialize network..." << std::endl;
-                nn.reset();
-                nn << net_string;
-            }
+                cur_nn << net_string;
+            // t only carries the configuration: it is never trained itself
+            tipl::ml::trainer cur_t(t);
 
             if(seed_search)
             {
-                std::cout << "seed searching for " << seed_search << " times" << std::endl;
-                t.seed_search(nn,train_data[fold],terminated,seed_search);
+                std::cout << "seed searching for " << seed_search << " times at fold=" << fold << std::endl;
+                cur_t.seed_search(cur_nn,train_data[fold],terminated,seed_search);
             }
 
-            if(!nn.initialized)
-                nn.init_weights(0);
+            if(!cur_nn.initialized)
+                cur_nn.init_weights(0);
 
             int round = 0;
-            test_result.clear();
-            std::cout << "start training..." << std::endl;
-            t.train(nn,train_data[fold],terminated, [&]()
+            std::vector<float> cur_test_result;
+            cur_t.train(cur_nn,train_data[fold],terminated, [&]()
             {
-                nn.set_test_mode(true);
+                cur_nn.set_test_mode(true);
                 //nn.sort_fully_layer();
 
                 // fiber convolution
                 {
                     const double rr = 0.0001;
-                    float* w = &(nn.layers[0]->weight[0]);
-                    for(int i = 0;i < nn.layers[0]->output_size;++i,w += nn.layers[0]->input_size)
+                    int input_size = cur_nn.layers[0]->input_size;
+                    tipl::par_for2(cur_nn.layers[0]->output_size,[&](int i,unsigned int)
                     {
+                        float* w = &(cur_nn.layers[0]->weight[0]) + i*input_size;
                         for(size_t j = 0;j < fib_pairs.size();++j)
                         {
                             float& a = w[fib_pairs[j].first];
@@ -248,58 +296,50 @@ bool nn_connectometry_analysis::run(const std::string& net_string_)
                             a = (double)a*(1.0-rr) + m;
                             b = (double)b*(1.0-rr) + m;
                         }
-                    }
+                    },inner_thread_count);
                 }
 
-                std::cout << "[" << round << "]";
-                cur_progress = (fold*t.epoch + round)*100/(cv_fold*t.epoch);
-                test_result.resize(test_data[0].size());
-                nn.predict(test_data[fold],test_result);
+                cur_test_result.resize(test_data[fold].size());
+                cur_nn.predict(test_data[fold],cur_test_result);
 
+                std::ostringstream out;
+                out << "fold=" << fold << " [" << round << "]";
                 {
                     std::lock_guard<std::mutex> lock(lock_result);
                     if(is_regression)//regression
                     {
-                        result_r.push_back(test_data[fold].calculate_r(test_result));
-                        result_mae.push_back(test_data[fold].calculate_mae(test_result));
-                        std::cout << " mae=" << result_mae.back();
-                        std::cout << " r=" << std::setprecision(3) << result_r.back();
+                        result_r[fold].push_back(test_data[fold].calculate_r(cur_test_result));
+                        result_mae[fold].push_back(test_data[fold].calculate_mae(cur_test_result));
+                        out << " mae=" << result_mae[fold].back();
+                        out << " r=" << std::setprecision(3) << result_r[fold].back();
                     }
                     else
                     {
-                        result_test_miss.push_back(test_data[fold].calculate_miss(test_result));
-                        result_test_error.push_back(1.0f-(float)result_test_miss.back()/(float)test_data[fold].size());
-                        std::cout << " miss=" << result_test_miss.back() << "/" << test_data[fold].size();
-                        std::cout << " accuracy=" << std::setprecision(3) <<  result_test_error.back() ;
+                        result_test_miss[fold].push_back(test_data[fold].calculate_miss(cur_test_result));
+                        result_test_error[fold].push_back(1.0f-(float)result_test_miss[fold].back()/(float)test_data[fold].size());
+                        out << " miss=" << result_test_miss[fold].back() << "/" << test_data[fold].size();
+                        out << " accuracy=" << std::setprecision(3) <<  result_test_error[fold].back() ;
+                    }
+                    result_train_error[fold].push_back(cur_t.get_training_error_value());
+                    out << " error=" << std::setprecision(3) << result_train_error[fold].back()
+                        << " rate= " << std::setprecision(3) << cur_t.rate_decay;
+                    fold_test_result[fold] = cur_test_result;
+                    if(int(fold) == cur_fold)
+                    {
+                        test_seq = test_data[fold].pos;
+                        test_result = cur_test_result;
                     }
-                    result_train_error.push_back(t.get_training_error_value());
+                    ++round_count;
+                    cur_progress = round_count*100/(cv_fold*t.epoch);
                 }
-
-                std::cout << " error=" << std::setprecision(3) << result_train_error.back()
-                << " rate= " << std::setprecision(3) << t.rate_decay << std::endl;
-
-
+                std::cout << out.str() << std::endl;
                 ++round;
             });
-
-            all_test_seq.insert(all_test_seq.end(),test_seq.begin(),test_seq.end());
-            all_test_result.insert(all_test_result.end(),test_result.begin(),test_result.end());
-            std::vector<float> y(all_test_result.size());
-            float all_mae = 0.0f,all_accuracy = 0.0f;
-            for(int i = 0;i < y.size();++i)
-            {
-                y[i] = fp_data.data_label[all_test_seq[i]];
-                all_mae += std::fabs(y[i]-all_test_result[i]);
-                all_accuracy += (std::round(y[i]) == std::round(all_test_result[i]) ? 1.0f:0.0f);
-            }
-
-            std::ostringstream out;
-            out << " " << cv_fold << " fold cross validation results shows that"
-                << " r=" << tipl::correlation(y.begin(),y.end(),all_test_result.begin())
-                << ", mae=" << all_mae/(float)y.size()
-                << ", accuracy = " << (int)all_accuracy << "/" << y.size() << " = " << 100.0f*(float)all_accuracy/(float)y.size() << "%.";
-            all_result = out.str();
-        }
+            if(terminated)
+                return;
+            std::lock_guard<std::mutex> lock(lock_result);
+            end_fold(fold);
+        },fold_thread_count);
         terminated = true;
     });
     return true;
@@ -3,6 +3,7 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include <thread>
 #include <tipl/tipl.hpp>
 
 class fib_data;
@@ -40,25 +41,38 @@ public:
     std::vector<float> all_test_result;
     std::string all_result;
 private:
+    // round-by-round results of each fold
     std::mutex lock_result;
-    std::vector<float> result_r;
-    std::vector<float> result_mae;
-    std::vector<float> result_test_miss;
-    std::vector<float> result_test_error;
-    std::vector<float> result_train_error;
+    std::vector<std::vector<float> > result_r;
+    std::vector<std::vector<float> > result_mae;
+    std::vector<std::vector<float> > result_test_miss;
+    std::vector<std::vector<float> > result_test_error;
+    std::vector<std::vector<float> > result_train_error;
+    std::vector<std::vector<float> > fold_test_result;
+    std::vector<char> fold_done;
+    int round_count = 0;
+    void end_fold(size_t fold);
 public:
     void clear_results(void);
-    bool has_results(void){return !result_train_error.empty();}
+    bool has_results(void)
+    {
+        std::lock_guard<std::mutex> lock(lock_result);
+        return size_t(cur_fold) < result_train_error.size() && !result_train_error[size_t(cur_fold)].empty();
+    }
+    // results of cur_fold, the first fold still in training
     template<typename fun>
     void get_results(fun f)
     {
         std::lock_guard<std::mutex> lock(lock_result);
+        if(size_t(cur_fold) >= result_train_error.size())
+            return;
+        size_t fold = size_t(cur_fold);
         if(is_regression) // regression
-            for(size_t i = 0;i < result_r.size();++i)
-                f(i,result_r[i],result_mae[i],result_train_error[i]);
+            for(size_t i = 0;i < result_r[fold].size();++i)
+                f(i,result_r[fold][i],result_mae[fold][i],result_train_error[fold][i]);
         else
-            for(size_t i = 0;i < result_test_error.size();++i)
-                f(i,result_test_miss[i],result_test_error[i],result_train_error[i]);
+            for(size_t i = 0;i < result_test_error[fold].size();++i)
+                f(i,result_test_miss[fold][i],result_test_error[fold][i],result_train_error[fold][i]);
 
     }
 public:
@@ -69,6 +83,8 @@ public:
     float no_data = 9999.0f;
     size_t cv_fold = 10;
     bool normalize_value = false;
+    // folds are trained concurrently on their own networks within this budget
+    unsigned int thread_count = std::max<unsigned int>(1,std::thread::hardware_concurrency());
 public:
     int cur_progress = 0;
     int cur_fold = 0;
@@ -2,6 +2,7 @@
 #include <QProgressDialog>
 #include <QFileDialog>
 #include <QSettings>
+#include <atomic>
 #include "dicom_parser.h"
 #include "ui_dicom_parser.h"
 #include "tipl/tipl.hpp"
@@ -449,121 +450,136 @@ bool load_4d_2dseq(const char* file_name,std::vector<std::shared_ptr<DwiHeader>
     return true;
 }
 
+// parse the headers and decode the pixel data of all files in parallel
+// files[i] is empty if file_list[i] cannot be opened
+bool open_dwi_files(const QStringList& file_list,std::vector<std::shared_ptr<DwiHeader> >& files)
+{
+    std::vector<std::string> file_names(file_list.size());
+    for(unsigned int index = 0;index < file_list.size();++index)
+        file_names[index] = file_list[index].toLocal8Bit().begin();
+    files.clear();
+    files.resize(file_names.size());
+    std::atomic<bool> aborted(false);
+    begin_prog("loading images");
+    tipl::par_for2(file_names.size(),[&](unsigned int index,unsigned int id)
+    {
+        if(aborted)
+            return;
+        if(!id)
+        {
+            check_prog(index,file_names.size());
+            if(prog_aborted())
+            {
+                aborted = true;
+                return;
+            }
+        }
+        std::shared_ptr<DwiHeader> dwi(new DwiHeader);
+        if(!dwi->open(file_names[index].c_str()))
+            return;
+        dwi->file_name = file_names[index];
+        files[index] = dwi;
+    });
+    check_prog(0,0);
+    return !aborted;
+}
+
 bool load_multiple_slice_dicom(QStringList file_list,std::vector<std::shared_ptr<DwiHeader> >& dwi_files)
 {
     tipl::io::dicom dicom_header;// multiple frame image
     tipl::geometry<3> geo;
-    if(!dicom_header.load_from_file(file_list[0].toLocal8Bit().begin()))
+    if(file_list.size() < 2 || !dicom_header.load_from_file(file_list[0].toLocal8Bit().begin()))
         return false;
     dicom_header.get_image_dimension(geo);
     // philips or GE single slice images
     if(geo[2] != 1 || dicom_header.is_mosaic)
         return false;
 
-    tipl::io::dicom dicom_header2;
-    if(!dicom_header2.load_from_file(file_list[1].toLocal8Bit().begin()))
+    // every file is read once, and the slice order is determined from the parsed headers
+    std::vector<std::shared_ptr<DwiHeader> > files;
+    if(!open_dwi_files(file_list,files))
         return false;
+    for(unsigned int index = 0;index < files.size();++index)
+        if(!files[index].get())
+            return false;
+
     float s1 = dicom_header.get_slice_location();
     bool iterate_slice_first = true;
     unsigned int slice_num = 2;
     unsigned int b_num = 2;
+    const DwiHeader& dwi1 = *files[0];
     if(s1 == 0.0) // no slice locaton information
     {
-        DwiHeader dwi1,dwi2;
-        dwi1.open(file_list[0].toLocal8Bit().begin());
-        dwi2.open(file_list[1].toLocal8Bit().begin());
-        if(dwi1.bvec == dwi2.bvec && dwi1.bvalue == dwi2.bvalue) // iterater slice first
+        if(dwi1.bvec == files[1]->bvec && dwi1.bvalue == files[1]->bvalue) // iterater slice first
         {
-            for (;slice_num < file_list.size();++slice_num)
-            {
-                DwiHeader dwi;
-                if(!dwi.open(file_list[slice_num].toLocal8Bit().begin()))
-                    return false;
-                if(dwi1.bvec != dwi.bvec || dwi1.bvalue != dwi.bvalue)
+            for (;slice_num < files.size();++slice_num)
+                if(dwi1.bvec != files[slice_num]->bvec || dwi1.bvalue != files[slice_num]->bvalue)
                     break;
-            }
             geo[2] = slice_num;
             iterate_slice_first = true;
         }
         else
         // iterate b first
         {
-            for (;b_num < file_list.size();++b_num)
-            {
-                DwiHeader dwi;
-                if(!dwi.open(file_list[b_num].toLocal8Bit().begin()))
-                    return false;
-                if(dwi1.bvec == dwi.bvec && dwi1.bvalue == dwi.bvalue)
+            for (;b_num < files.size();++b_num)
+                if(dwi1.bvec == files[b_num]->bvec && dwi1.bvalue == files[b_num]->bvalue)
                     break;
-            }
-            geo[2] = file_list.size()/b_num;
+            geo[2] = files.size()/b_num;
             iterate_slice_first = false;
         }
     }
     else
     {
-        if(s1 == dicom_header2.get_slice_location()) // iterater b-value first
+        if(s1 == files[1]->slice_location) // iterater b-value first
         {
-            for (;b_num < file_list.size();++b_num)
-            {
-                if(!dicom_header2.load_from_file(file_list[b_num].toLocal8Bit().begin()))
-                    return false;
-                if(dicom_header2.get_slice_location() != s1)
+            for (;b_num < files.size();++b_num)
+                if(files[b_num]->slice_location != s1)
                     break;
-            }
-            geo[2] = std::ceil((float)file_list.size()/(float)b_num);
+            geo[2] = std::ceil((float)files.size()/(float)b_num);
             iterate_slice_first = false;
         }
         else
         // iterater slice first
         {
-            for (;slice_num < file_list.size();++slice_num)
-            {
-                if(!dicom_header2.load_from_file(file_list[slice_num].toLocal8Bit().begin()))
-                    return false;
-                if(dicom_header2.get_slice_location() == s1)
+            for (;slice_num < files.size();++slice_num)
+                if(files[slice_num]->slice_location == s1)
                     break;
-            }
             geo[2] = slice_num;
             iterate_slice_first = true;
         }
     }
 
-
-    begin_prog("loading images");
-    for (unsigned int index = 0,b_index = 0,slice_index = 0;check_prog(index,file_list.size());++index)
+    // the first slice of each volume becomes the volume, and the other slices are copied into it
+    std::vector<std::vector<unsigned int> > volume_files;
+    for (unsigned int index = 0;index < files.size();++index)
     {
-        std::shared_ptr<DwiHeader> dwi(new DwiHeader);
-        if(!dwi->open(file_list[index].toLocal8Bit().begin()))
-            return false;
+        unsigned int b_index = iterate_slice_first ? index / slice_num : index % b_num;
+        unsigned int slice_index = iterate_slice_first ? index % slice_num : index / b_num;
         if(slice_index == 0)
+            volume_files.push_back(std::vector<unsigned int>(geo[2],files.size()));
+        if(slice_index < geo[2] && b_index < volume_files.size())
+            volume_files[b_index][slice_index] = index;
+    }
+    // volumes are assembled one at a time and each slice is released once copied,
+    // so the slices and the assembled volumes are not all held at the same time
+    for (unsigned int b_index = 0;b_index < volume_files.size();++b_index)
+    {
+        const std::vector<unsigned int>& slices = volume_files[b_index];
+        std::shared_ptr<DwiHeader> volume = files[slices[0]];
+        volume->image.resize(geo);
+        dicom_header.get_voxel_size(volume->voxel_size);
+        tipl::par_for(slices.size(),[&](unsigned int slice_index)
         {
-            dwi_files.push_back(dwi);
-            dwi_files.back()->file_name = file_list[index].toLocal8Bit().begin();
-            dwi_files.back()->image.resize(geo);
-            dicom_header.get_voxel_size(dwi_files.back()->voxel_size);
-        }
-        else
-            std::copy(dwi->image.begin(),dwi->image.end(),
-                dwi_files[b_index]->image.begin() + slice_index*geo.plane_size());
-        if(iterate_slice_first)
-        {
-            ++slice_index;
-            if(slice_index >= slice_num)
-            {
-                slice_index = 0;
-                ++b_index;
-            }
-        }
-        else
-        {
-            ++b_index;
-            if(b_index >= b_num)
-            {
-                b_index = 0;
-                ++slice_index;
-            }
-        }
+            unsigned int index = slices[slice_index];
+            if(slice_index == 0 || index >= files.size() ||
+               files[index]->image.size() != geo.plane_size())
+                return;
+            std::copy(files[index]->image.begin(),files[index]->image.end(),
+                      volume->image.begin() + slice_index*geo.plane_size());
+            files[index].reset();
+        });
+        files[slices[0]].reset();
+        dwi_files.push_back(volume);
     }
     return true;
 }
@@ -667,15 +683,12 @@ bool load_4d_fdf(QStringList file_list,std::vector<std::shared_ptr<DwiHeader> >&
 
 bool load_3d_series(QStringList file_list,std::vector<std::shared_ptr<DwiHeader> >& dwi_files)
 {
-    begin_prog("loading images");
-    for (unsigned int index = 0;check_prog(index,file_list.size());++index)
-    {
-        std::shared_ptr<DwiHeader> new_file(new DwiHeader);
-        if (!new_file->open(file_list[index].toLocal8Bit().begin()))
-            continue;
-        new_file->file_name = file_list[index].toLocal8Bit().begin();
-        dwi_files.push_back(new_file);
-    }
+    std::vector<std::shared_ptr<DwiHeader> > files;
+    if(!open_dwi_files(file_list,files))
+        return false;
+    for (unsigned int index = 0;index < files.size();++index)
+        if(files[index].get())
+            dwi_files.push_back(files[index]);
     return !dwi_files.empty();
 }
 
@@ -795,10 +808,14 @@ void dicom_parser::on_buttonBox_accepted()
                     ui->tableWidget->item(index,4)->text().toFloat());
     }
 
-    DwiHeader::output_src(ui->SrcName->text().toLocal8Bit().begin(),
+    if(!DwiHeader::output_src(ui->SrcName->text().toLocal8Bit().begin(),
                           dwi_files,
                           ui->upsampling->currentIndex(),
-                          ui->sort_btable->isChecked());
+                          ui->sort_btable->isChecked()))
+    {
+        QMessageBox::information(this,"Error","Cannot save SRC file. Please check the disk space and write permission.",0);
+        return;
+    }
 
     dwi_files.clear();
     if(QFileInfo(ui->SrcName->text()).suffix() != "gz")
@@ -75,6 +75,7 @@ bool DwiHeader::open(const char* filename)
             std::copy(I.begin(),I.end(),image.begin());
     }
     header.get_voxel_size(voxel_size);
+    slice_location = header.get_slice_location();
     get_report_from_dicom(header,report);
 
     float orientation_matrix[9];
@@ -526,35 +527,46 @@ bool DwiHeader::output_src(const char* di_file,std::vector<std::shared_ptr<DwiHe
         write_mat.write("mask",dwi_files[0]->mask);
 
     //store images
+    // resampling runs in parallel a group of images at a time, and the block gzip
+    // writer compresses each batch in the background while the next group is prepared
     begin_prog("Save Files");
-    for (unsigned int index = 0;check_prog(index,(unsigned int)(dwi_files.size()));++index)
+    unsigned int group_size = upsampling ? std::max<unsigned int>(1,std::thread::hardware_concurrency()):1;
+    std::vector<tipl::image<unsigned short,3> > buffer;
+    for (unsigned int from = 0;check_prog(from,(unsigned int)(dwi_files.size()));from += group_size)
     {
-        std::ostringstream name;
-        tipl::image<unsigned short,3> buffer;
-        const unsigned short* ptr = 0;
-        name << "image" << index;
-        ptr = (const unsigned short*)dwi_files[index]->begin();
+        unsigned int to = std::min<unsigned int>(from+group_size,(unsigned int)(dwi_files.size()));
         if(upsampling)
         {
-            buffer.resize(geo);
-            std::copy(ptr,ptr+geo.size(),buffer.begin());
-            if(upsampling == 1)
-                tipl::upsampling(buffer);
-            if(upsampling == 2)
-                tipl::downsampling(buffer);
-            if(upsampling == 3)
+            buffer.resize(to-from);
+            tipl::par_for(to-from,[&](unsigned int i)
             {
-                tipl::upsampling(buffer);
-                tipl::upsampling(buffer);
-            }
-            if(upsampling == 4)
-            {
-                tipl::downsampling(buffer);
-                tipl::downsampling(buffer);
-            }
-            ptr = (const unsigned short*)&*buffer.begin();
+                const unsigned short* ptr = (const unsigned short*)dwi_files[from+i]->begin();
+                buffer[i].resize(geo);
+                std::copy(ptr,ptr+geo.size(),buffer[i].begin());
+                if(upsampling == 1)
+                    tipl::upsampling(buffer[i]);
+                if(upsampling == 2)
+                    tipl::downsampling(buffer[i]);
+                if(upsampling == 3)
+                {
+                    tipl::upsampling(buffer[i]);
+                    tipl::upsampling(buffer[i]);
+                }
+                if(upsampling == 4)
+                {
+                    tipl::downsampling(buffer[i]);
+                    tipl::downsampling(buffer[i]);
+                }
+            });
+        }
+        for (unsigned int index = from;index < to;++index)
+        {
+            std::ostringstream name;
+            name << "image" << index;
+            const unsigned short* ptr = upsampling ? (const unsigned short*)&*buffer[index-from].begin() :
+                                                     (const unsigned short*)dwi_files[index]->begin();
+            write_mat.write(name.str().c_str(),ptr,1,output_size);
         }
-        write_mat.write(name.str().c_str(),ptr,1,output_size);
     }
 
 
@@ -571,5 +583,7 @@ bool DwiHeader::output_src(const char* di_file,std::vector<std::shared_ptr<DwiHe
     }
     report1 += report2;
     write_mat.write("report",report1);
-    return true;
+    // the last batch is compressed in the background, and a failure shows up only after closing
+    write_mat.close_file();
+    return !(!write_mat);
 }
@@ -17,9 +17,10 @@ public:// for HCP dataset
 public:
     tipl::vector<3,float> bvec;
     float bvalue,te;
+    float slice_location;
     tipl::vector<3,float> voxel_size;
 public:
-    DwiHeader(void): bvalue(0.0f), te(0.0f) {}
+    DwiHeader(void): bvalue(0.0f), te(0.0f), slice_location(0.0f) {}
     bool open(const char* filename);
 public:
     const unsigned short* begin(void) const
@@ -40,6 +40,7 @@ INCLUDEPATH += libs \
     libs/tracking \
     libs/mapping
 HEADERS += mainwindow.h \
+    libs/utility/memory_info.hpp \
     dicom/dicom_parser.h \
     dicom/dwi_header.hpp \
     libs/dsi/tessellated_icosahedron.hpp \
@@ -60,6 +61,8 @@ HEADERS += mainwindow.h \
     libs/tracking/fib_data.hpp \
     libs/tracking/basic_process.hpp \
     libs/tracking/tract_cluster.hpp \
+    libs/tracking/tract_index.hpp \
+    libs/tracking/tract_arena.hpp \
     tracking/region/regiontablewidget.h \
     tracking/region/Regions.h \
     tracking/region/RegionModel.h \
@@ -116,6 +119,7 @@ SOURCES += main.cpp \
     dicom/dicom_parser.cpp \
     dicom/dwi_header.cpp \
     libs/utility/prog_interface.cpp \
+    libs/utility/memory_info.cpp \
     libs/dsi/dsi_interface_imp.cpp \
     libs/tracking/interpolation_process.cpp \
     libs/tracking/tract_cluster.cpp \
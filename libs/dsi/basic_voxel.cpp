@@ -10,14 +10,33 @@ float base_function(float theta)
 
 void Voxel::init(void)
 {
+    auto init_data = [this](VoxelData& data)
+    {
+        data.space.resize(bvalues.size());
+        data.odf.resize(ti.half_vertices_count);
+        data.fa.resize(max_fiber_number);
+        data.dir_index.resize(max_fiber_number);
+        data.dir.resize(max_fiber_number);
+    };
     voxel_data.resize(thread_count);
     for (unsigned int index = 0; index < thread_count; ++index)
     {
-        voxel_data[index].space.resize(bvalues.size());
-        voxel_data[index].odf.resize(ti.half_vertices_count);
-        voxel_data[index].fa.resize(max_fiber_number);
-        voxel_data[index].dir_index.resize(max_fiber_number);
-        voxel_data[index].dir.resize(max_fiber_number);
+        init_data(voxel_data[index]);
+        voxel_data[index].thread_id = index;
+    }
+    voxel_block.clear();
+    if(block_size > 1)
+    {
+        voxel_block.resize(thread_count);
+        for (unsigned int index = 0; index < thread_count; ++index)
+        {
+            voxel_block[index].resize(block_size);
+            for (unsigned int j = 0; j < block_size; ++j)
+            {
+                init_data(voxel_block[index][j]);
+                voxel_block[index][j].thread_id = index;
+            }
+        }
     }
     for (unsigned int index = 0; index < process_list.size(); ++index)
         process_list[index]->init(*this);
@@ -71,12 +90,14 @@ void Voxel::load_from_src(ImageModel& image_model)
     bvalues.clear();
     bvectors.clear();
     dwi_data.clear();
+    dwi_src_index.clear();
     // include only the first b0
     if(image_model.src_bvalues[sorted_index[0]] == 0.0f)
     {
         bvalues.push_back(0);
         bvectors.push_back(tipl::vector<3,float>(0,0,0));
         dwi_data.push_back(image_model.src_dwi_data[sorted_index[0]]);
+        dwi_src_index.push_back(sorted_index[0]);
         b0_index = 0;
     }
     for(size_t i = 0;i < sorted_index.size();++i)
@@ -85,6 +106,7 @@ void Voxel::load_from_src(ImageModel& image_model)
             bvalues.push_back(image_model.src_bvalues[sorted_index[i]]);
             bvectors.push_back(image_model.src_bvectors[sorted_index[i]]);
             dwi_data.push_back(image_model.src_dwi_data[sorted_index[i]]);
+            dwi_src_index.push_back(sorted_index[i]);
         }
 
     if(image_model.has_image_rotation)
@@ -122,21 +144,15 @@ void Voxel::calculate_mask(const tipl::image<float,3>& dwi_sum)
 }
 
 
-void Voxel::run(void)
+void Voxel::run_voxel(size_t from,size_t to)
 {
-    try{
-
-    size_t total_voxel = 0;
     bool terminated = false;
-    for(size_t index = 0;index < mask.size();++index)
-        if (mask[index])
-            ++total_voxel;
-
     size_t total = 0;
-    tipl::par_for2(mask.size(),
+    tipl::par_for2(to-from,
                     [&](size_t voxel_index,size_t thread_id)
     {
         ++total;
+        voxel_index += from;
         if(terminated || !mask[voxel_index])
             return;
         if(thread_id == 0)
@@ -146,13 +162,67 @@ void Voxel::run(void)
                 terminated = true;
                 return;
             }
-            check_prog(uint32_t(total*100/mask.size()),100);
+            check_prog(uint32_t(total*100/(to-from)),100);
         }
         voxel_data[thread_id].init();
         voxel_data[thread_id].voxel_index = voxel_index;
         for (size_t index = 0; index < process_list.size(); ++index)
             process_list[index]->run(*this,voxel_data[thread_id]);
     },thread_count);
+}
+
+void Voxel::run_block(size_t from,size_t to)
+{
+    std::vector<size_t> voxel_list;
+    for(size_t index = from;index < to;++index)
+        if (mask[index])
+            voxel_list.push_back(index);
+
+    bool terminated = false;
+    size_t total = 0;
+    size_t block_count = (voxel_list.size()+block_size-1)/block_size;
+    tipl::par_for2(block_count,
+                    [&](size_t block_index,size_t thread_id)
+    {
+        ++total;
+        if(terminated)
+            return;
+        if(thread_id == 0)
+        {
+            if(prog_aborted())
+            {
+                terminated = true;
+                return;
+            }
+            check_prog(uint32_t(total*100/block_count),100);
+        }
+        std::vector<VoxelData>& block = voxel_block[thread_id];
+        size_t from = block_index*block_size;
+        size_t count = std::min<size_t>(block_size,voxel_list.size()-from);
+        for (size_t index = 0; index < count; ++index)
+        {
+            block[index].init();
+            block[index].voxel_index = voxel_list[from+index];
+        }
+        for (size_t index = 0; index < process_list.size(); ++index)
+            process_list[index]->run_block(*this,block,count);
+    },thread_count);
+}
+
+void Voxel::run(void)
+{
+    try{
+    size_t slab_size = slab_thickness ? size_t(slab_thickness)*dim.plane_size() : mask.size();
+    for(size_t from = 0;from < mask.size() && !prog_aborted();from += slab_size)
+    {
+        size_t to = std::min<size_t>(from+slab_size,mask.size());
+        if(slab_thickness && !load_slab(int(from/dim.plane_size()),int(to/dim.plane_size())))
+            throw std::runtime_error("Cannot read DWI slices from the SRC file");
+        if(voxel_block.empty())
+            run_voxel(from,to);
+        else
+            run_block(from,to);
+    }
     check_prog(1,1);
     }
     catch(std::exception& error)
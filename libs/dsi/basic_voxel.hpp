@@ -5,6 +5,7 @@
 #include <boost/mpl/inherit_linearly.hpp>
 #include <tipl/tipl.hpp>
 #include <string>
+#include <functional>
 #include "tessellated_icosahedron.hpp"
 #include "gzip_interface.hpp"
 #include "prog_interface_static_link.h"
@@ -18,6 +19,12 @@ public:
     BaseProcess(void) {}
     virtual void init(Voxel&) {}
     virtual void run(Voxel&, VoxelData&) {}
+    // process a tile of voxels, overridden by processes that can batch their computation
+    virtual void run_block(Voxel& voxel, std::vector<VoxelData>& block,size_t count)
+    {
+        for(size_t index = 0;index < count;++index)
+            run(voxel,block[index]);
+    }
     virtual void end(Voxel&,gz_mat_write&) {}
     virtual ~BaseProcess(void) {}
 };
@@ -27,6 +34,7 @@ public:
 struct VoxelData
 {
     size_t voxel_index;
+    unsigned int thread_id = 0;// reconstruction thread that owns this slot
     std::vector<float> space;
     std::vector<float> odf;
     std::vector<float> odf1,odf2;
@@ -36,6 +44,8 @@ struct VoxelData
     std::vector<unsigned short> dir_index;
     float min_odf;
     tipl::matrix<3,3,float> jacobian;
+    std::vector<float> space_buf,odf_buf; // work space reused across voxels
+    std::vector<double> param_buf; // work space reused across voxel blocks
 
     void init(void)
     {
@@ -59,12 +69,18 @@ public:
     void calculate_mask(const tipl::image<float,3>& dwi_sum);
 public:
     std::vector<const unsigned short*> dwi_data;
+    std::vector<size_t> dwi_src_index;// SRC image of each dwi_data
     std::vector<tipl::vector<3,float> > bvectors;
     std::vector<float> bvalues;
 
     std::string report,steps;
     std::ostringstream recon_report, step_report;
     unsigned int thread_count = 1;
+    unsigned int block_size = 256;// voxels per tile, 0 or 1 for voxel-by-voxel reconstruction
+public:// slab streaming: dwi_data only covers the slices given to load_slab
+    unsigned int slab_thickness = 0;// 0: whole volume in memory
+    size_t dwi_offset = 0;// voxel index of dwi_data[i][0], the first voxel of the loaded slab
+    std::function<bool(int,int)> load_slab;
     void load_from_src(ImageModel& image_model);
 public:
     unsigned char method_id;
@@ -73,6 +89,7 @@ public:
 public:
     std::string file_name;
     bool output_odf = false;
+    unsigned char odf_bits = 0;// 8 or 16: ODFs stored quantized (see write_odf_block)
     bool check_btable = true;
     unsigned int max_fiber_number = 5;
     std::vector<std::string> file_list;
@@ -84,6 +101,7 @@ public://used in GQI
     bool odf_resolving = false;
     bool r2_weighted = false;// used in GQI only
     bool half_sphere = false;
+    bool sinc_lookup = true;// tabulated sinc in QSDR and grad_dev, false for exact evaluation
     int b0_index = -1;
     void calculate_sinc_ql(std::vector<float>& sinc_ql);
     void calculate_q_vec_t(std::vector<tipl::vector<3,float> >& q_vector_time);
@@ -128,6 +146,10 @@ public:// for template creation
     std::string template_file_name;
 public:
     std::vector<VoxelData> voxel_data;
+    std::vector<std::vector<VoxelData> > voxel_block;
+private:
+    void run_voxel(size_t from,size_t to);
+    void run_block(size_t from,size_t to);
 public:
     Voxel(void):param(5){}
     template<class ProcessList>
@@ -9,6 +9,7 @@
 #include "gqi_process.hpp"
 #include "gqi_mni_reconstruction.hpp"
 #include "image_model.hpp"
+#include "fib_data.hpp"
 
 
 typedef boost::mpl::vector<
@@ -96,6 +97,14 @@ const char* ImageModel::reconstruction(void)
     {
         if(!is_human_data())
             voxel.csf_calibration = false;
+        if(src_stream.get())
+        {
+            // only methods that read DWI voxel by voxel in the native space can be streamed
+            if((voxel.method_id != 1 && voxel.method_id != 4) ||
+               !voxel.study_src_file_path.empty() || src_dwi_data.size() == 1)
+                return "Slab streaming only supports DTI and GQI reconstruction";
+            voxel.csf_calibration = false;
+        }
         voxel.recon_report.clear();
         voxel.recon_report.str("");
         voxel.step_report.clear();
@@ -315,7 +324,7 @@ const char* odf_average(const char* out_name,std::vector<std::string>& file_name
     for (unsigned int index = 0;check_prog(index,file_names.size());++index)
     {
         const char* file_name = file_names[index].c_str();
-        gz_mat_read reader;
+        gz_mat_lazy_read reader;
         set_title(file_names[index].c_str());
         if(!reader.load_from_file(file_name))
         {
@@ -423,22 +432,8 @@ const char* odf_average(const char* out_name,std::vector<std::string>& file_name
 
         std::vector<const float*> odf_bufs;
         std::vector<unsigned int> odf_bufs_size;
-        //get_odf_bufs(reader,odf_bufs,odf_bufs_size);
-        {
-            odf_bufs.clear();
-            odf_bufs_size.clear();
-            for (unsigned int odf_index = 0;1;++odf_index)
-            {
-                std::ostringstream out;
-                out << "odf" << odf_index;
-                const float* odf_buf = 0;
-                if (!reader.read(out.str().c_str(),row,col,odf_buf))
-                    break;
-                odf_bufs.push_back(odf_buf);
-                odf_bufs_size.push_back(row*col);
-            }
-        }
-        if(odf_bufs.empty())
+        std::vector<std::vector<float> > decoded_odfs;
+        if(!read_odf_blocks(reader,odf_bufs,odf_bufs_size,decoded_odfs))
         {
             error_msg += "No ODF data found in ";
             error_msg += file_name;
@@ -4,6 +4,44 @@
 #include "basic_voxel.hpp"
 #include "tipl/tipl.hpp"
 
+// Eigenvalues of a symmetric 3-by-3 matrix in descending order by the
+// trigonometric solution of the characteristic polynomial, and the eigenvector
+// of the largest one from the cross product of two rows of A-d0*I. Returns false
+// when the largest eigenvalue is (nearly) repeated and the vector is ill-defined.
+inline bool eigen_decomposition_sym3(const double* A,double* d,double* V)
+{
+    double p1 = A[1]*A[1]+A[2]*A[2]+A[5]*A[5];
+    double q = (A[0]+A[4]+A[8])/3.0;
+    double p2 = (A[0]-q)*(A[0]-q)+(A[4]-q)*(A[4]-q)+(A[8]-q)*(A[8]-q)+2.0*p1;
+    if(p2 == 0.0)
+        return false;
+    double p = std::sqrt(p2/6.0);
+    double b0 = (A[0]-q)/p,b4 = (A[4]-q)/p,b8 = (A[8]-q)/p;
+    double b1 = A[1]/p,b2 = A[2]/p,b5 = A[5]/p;
+    double r = 0.5*(b0*(b4*b8-b5*b5)-b1*(b1*b8-b5*b2)+b2*(b1*b5-b4*b2));
+    double phi = r <= -1.0 ? 3.14159265358979323846/3.0 : (r >= 1.0 ? 0.0 : std::acos(r)/3.0);
+    d[0] = q+2.0*p*std::cos(phi);
+    d[2] = q+2.0*p*std::cos(phi+2.0*3.14159265358979323846/3.0);
+    d[1] = 3.0*q-d[0]-d[2];
+    double r0[3] = {A[0]-d[0],A[1],A[2]};
+    double r1[3] = {A[3],A[4]-d[0],A[5]};
+    double r2[3] = {A[6],A[7],A[8]-d[0]};
+    double c[3][3] = {{r0[1]*r1[2]-r0[2]*r1[1],r0[2]*r1[0]-r0[0]*r1[2],r0[0]*r1[1]-r0[1]*r1[0]},
+                      {r0[1]*r2[2]-r0[2]*r2[1],r0[2]*r2[0]-r0[0]*r2[2],r0[0]*r2[1]-r0[1]*r2[0]},
+                      {r1[1]*r2[2]-r1[2]*r2[1],r1[2]*r2[0]-r1[0]*r2[2],r1[0]*r2[1]-r1[1]*r2[0]}};
+    double n[3];
+    for(unsigned int i = 0;i < 3;++i)
+        n[i] = c[i][0]*c[i][0]+c[i][1]*c[i][1]+c[i][2]*c[i][2];
+    unsigned int m = n[0] > n[1] ? (n[0] > n[2] ? 0:2) : (n[1] > n[2] ? 1:2);
+    if(n[m] <= 1.0e-8*p2*p2)
+        return false;
+    double l = 1.0/std::sqrt(n[m]);
+    V[0] = c[m][0]*l;
+    V[1] = c[m][1]*l;
+    V[2] = c[m][2]*l;
+    return true;
+}
+
 class Dwi2Tensor : public BaseProcess
 {
     std::vector<float> d0,d1,d2,d3,md,txx,txy,txz,tyy,tyz,tzz,ha;
@@ -23,6 +61,7 @@ private:
     std::vector<std::vector<double> > iKtK; // 6-by-6
     std::vector<std::vector<unsigned int> > iKtK_pivot;
     std::vector<double> Kt;
+    std::vector<double> iKtKKt; // (KtK)^-1 Kt, 6-by-b_count, the unregularized solve operator
     unsigned int b_count;
 public:
     virtual void init(Voxel& voxel)
@@ -106,34 +145,59 @@ public:
             }
             tipl::mat::lu_decomposition(iKtK[i].begin(),iKtK_pivot[i].begin(),tipl::dyndim(6,6));
         }
+        iKtKKt.resize(6*b_count);
+        for(unsigned int j = 0;j < b_count;++j)
+        {
+            double k[6],x[6];
+            for(unsigned int i = 0;i < 6;++i)
+                k[i] = Kt[i*b_count+j];
+            tipl::mat::lu_solve(iKtK[0].begin(),iKtK_pivot[0].begin(),k,x,tipl::dyndim(6,6));
+            for(unsigned int i = 0;i < 6;++i)
+                iKtKKt[i*b_count+j] = x[i];
+        }
     }
-public:
-    virtual void run(Voxel& voxel, VoxelData& data)
+    // log signal attenuation of the DWIs, written with the given stride
+    void get_signal(const std::vector<float>& space,float* signal,size_t stride) const
     {
-        if(!voxel.output_diffusivity && voxel.method_id != 1)
-            return;
-        std::vector<float> signal(data.space.size());
-        if (data.space.front() != 0.0f)
+        for (unsigned int i = 1; i < space.size(); ++i)
+            signal[(i-1)*stride] = 0.0f;
+        if (space.front() != 0.0f)
         {
-            float logs0 = std::log(std::max<float>(1.0,data.space.front()));
-            for (unsigned int i = 1; i < data.space.size(); ++i)
-                signal[i-1] = std::max<float>(0.0,logs0-std::log(std::max<float>(1.0,data.space[i])));
+            float logs0 = std::log(std::max<float>(1.0,space.front()));
+            for (unsigned int i = 1; i < space.size(); ++i)
+                signal[(i-1)*stride] = std::max<float>(0.0,logs0-std::log(std::max<float>(1.0,space[i])));
         }
-        //  Kt S = Kt K D
+    }
+    // tensor_param0 is the unregularized solution. The regularized systems are
+    // solved only if it does not give three positive eigenvalues.
+    void fit(Voxel& voxel,VoxelData& data,const double* tensor_param0,const float* signal,size_t stride)
+    {
         double KtS[6],tensor_param[6];
         double tensor[9];
         double V[9],d[3];
+        std::copy(tensor_param0,tensor_param0+6,tensor_param);
         for(unsigned int i = 0;i < iKtK.size();++i)
         {
-            tipl::mat::product(Kt.begin(),signal.begin(),KtS,tipl::dyndim(6,b_count),tipl::dyndim(b_count,1));
-            tipl::mat::lu_solve(iKtK[i].begin(),iKtK_pivot[i].begin(),KtS,tensor_param,tipl::dyndim(6,6));
-
+            if(i)
+            {
+                //  Kt S = Kt K D
+                for(unsigned int j = 0;j < 6;++j)
+                {
+                    double sum = 0.0;
+                    const double* k = &Kt[j*b_count];
+                    for(unsigned int l = 0;l < b_count;++l)
+                        sum += k[l]*double(signal[l*stride]);
+                    KtS[j] = sum;
+                }
+                tipl::mat::lu_solve(iKtK[i].begin(),iKtK_pivot[i].begin(),KtS,tensor_param,tipl::dyndim(6,6));
+            }
 
             unsigned int tensor_index[9] = {0,3,4,3,1,5,4,5,2};
             for (unsigned int index = 0; index < 9; ++index)
                 tensor[index] = tensor_param[tensor_index[index]];
 
-            tipl::mat::eigen_decomposition_sym(tensor,V,d,tipl::dim<3,3>());
+            if(i || !eigen_decomposition_sym3(tensor,d,V))
+                tipl::mat::eigen_decomposition_sym(tensor,V,d,tipl::dim<3,3>());
             if(d[0] > 0.0 && d[1] > 0.0 && d[2] > 0.0)
                 break;
         }
@@ -173,6 +237,48 @@ public:
         }
 
     }
+public:
+    virtual void run(Voxel& voxel, VoxelData& data)
+    {
+        if(!voxel.output_diffusivity && voxel.method_id != 1)
+            return;
+        std::vector<float>& signal = data.space_buf;
+        signal.resize(data.space.size());
+        get_signal(data.space,&signal[0],1);
+        double tensor_param[6];
+        tipl::mat::product(iKtKKt.begin(),signal.begin(),tensor_param,tipl::dyndim(6,b_count),tipl::dyndim(b_count,1));
+        fit(voxel,data,tensor_param,&signal[0],1);
+    }
+    virtual void run_block(Voxel& voxel, std::vector<VoxelData>& block,size_t count)
+    {
+        if(!voxel.output_diffusivity && voxel.method_id != 1)
+            return;
+        // dwi-major tile of log signals, solved for all voxels by one 6-by-b_count product
+        std::vector<float>& tile = block[0].space_buf;
+        tile.resize(size_t(b_count)*count);
+        for (size_t v = 0; v < count; ++v)
+            get_signal(block[v].space,&tile[v],count);
+        std::vector<double>& param = block[0].param_buf;
+        param.assign(6*count,0.0);
+        for (unsigned int j = 0; j < 6; ++j)
+        {
+            double* out = &param[j*count];
+            const float* t = &tile[0];
+            for (unsigned int i = 0; i < b_count; ++i,t += count)
+            {
+                double w = iKtKKt[j*b_count+i];
+                for (size_t v = 0; v < count; ++v)
+                    out[v] += w*t[v];
+            }
+        }
+        for (size_t v = 0; v < count; ++v)
+        {
+            double tensor_param[6];
+            for (unsigned int j = 0; j < 6; ++j)
+                tensor_param[j] = param[j*count+v];
+            fit(voxel,block[v],tensor_param,&tile[v],count);
+        }
+    }
     virtual void end(Voxel& voxel,gz_mat_write& mat_writer)
     {
         if(voxel.method_id == 1) // DTI
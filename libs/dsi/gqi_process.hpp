@@ -9,17 +9,96 @@
 #include "odf_process.hpp"
 
 float base_function(float theta);
+
+// odf = sinc_ql * space for a tile of voxels. The signals are transposed into a
+// dwi-major tile so that each row of sinc_ql is streamed once per tile and the
+// inner loop is a contiguous multiply-add over voxels.
+inline void block_odf_product(const float* sinc_ql,
+                              std::vector<VoxelData>& block,size_t count,
+                              unsigned int odf_size,unsigned int dwi_size,
+                              std::vector<float>& tile,std::vector<float>& odf_row)
+{
+    tile.resize(size_t(dwi_size)*count);
+    odf_row.resize(count);
+    for (size_t v = 0; v < count; ++v)
+    {
+        const float* space = &block[v].space[0];
+        for (size_t i = 0,pos = v; i < dwi_size; ++i,pos += count)
+            tile[pos] = space[i];
+    }
+    float* out = &odf_row[0];
+    for (unsigned int j = 0; j < odf_size; ++j,sinc_ql += dwi_size)
+    {
+        std::fill(odf_row.begin(),odf_row.end(),0.0f);
+        const float* t = &tile[0];
+        for (unsigned int i = 0; i < dwi_size; ++i,t += count)
+        {
+            float w = sinc_ql[i];
+            for (size_t v = 0; v < count; ++v)
+                out[v] += w*t[v];
+        }
+        for (size_t v = 0; v < count; ++v)
+            block[v].odf[j] = out[v];
+    }
+}
+
 class GQI_Recon  : public BaseProcess
 {
 public:// recorded for scheme balanced
     std::vector<tipl::vector<3,float> > q_vectors_time;
 public:
     std::vector<float> sinc_ql;
+public:// kernel rotated by the voxel jacobian in QSDR and grad_dev, one per thread
+    std::vector<std::vector<float> > rotated_sinc_ql;
+public:// sinc_pi or base_function tabulated over |q*v| for QSDR and grad_dev
+    // Linear interpolation at 1/256 spacing is within 7e-7 of sinc_pi. The
+    // base_function table is built in double precision with a series below
+    // 1e-3 and is within 5e-7 of the exact function. The float base_function
+    // loses its digits near 0 to cancellation (errors up to ~1 below 1e-3),
+    // so sinc_lookup=0 is less accurate there, not more.
+    static constexpr float sinc_table_scale = 256.0f;
+    static double base_function_double(double x)
+    {
+        if(std::fabs(x) < 1.0e-3)
+        {
+            double x2 = x*x;
+            return 1.0/3.0-x2/30.0+x2*x2/840.0;
+        }
+        return (2.0*std::cos(x)+(x-2.0/x)*std::sin(x))/x/x;
+    }
+    std::vector<float> sinc_table;
+    float sinc_value(float x) const
+    {
+        x = std::fabs(x)*sinc_table_scale;
+        if(!(x < float(sinc_table.size()-1))) // also catches nan from a zero jacobian
+            return sinc_table.back();
+        size_t k = size_t(x);
+        float w = x-float(k);
+        return sinc_table[k]+w*(sinc_table[k+1]-sinc_table[k]);
+    }
 public:
     virtual void init(Voxel& voxel)
     {
+        sinc_table.clear();
+        rotated_sinc_ql.clear();
         if(!voxel.grad_dev.empty() || voxel.qsdr)
+        {
+            rotated_sinc_ql.resize(std::max<unsigned int>(1,voxel.thread_count));
             voxel.calculate_q_vec_t(q_vectors_time);
+            if(voxel.sinc_lookup)
+            {
+                // |q*v| <= |q| since v is normalized
+                float max_q = 0.0f;
+                for (unsigned int i = 0; i < q_vectors_time.size(); ++i)
+                    max_q = std::max<float>(max_q,q_vectors_time[i].length());
+                sinc_table.resize(size_t(std::ceil(max_q*sinc_table_scale))+2);
+                for (size_t k = 0; k < sinc_table.size(); ++k)
+                {
+                    double x = double(k)/double(sinc_table_scale);
+                    sinc_table[k] = float(voxel.r2_weighted ? base_function_double(x) : boost::math::sinc_pi(x));
+                }
+            }
+        }
         else
             voxel.calculate_sinc_ql(sinc_ql);
     }
@@ -38,13 +117,18 @@ public:
                     data.jacobian[i] = voxel.grad_dev[i][data.voxel_index];
                 tipl::mat::transpose(data.jacobian.begin(),tipl::dim<3,3>());
             }
-            std::vector<float> sinc_ql_(data.odf.size()*data.space.size());
+            // reallocated only when the DWI count changes
+            std::vector<float>& sinc_ql_ = rotated_sinc_ql[data.thread_id];
+            sinc_ql_.resize(data.odf.size()*data.space.size());
             for (unsigned int j = 0,index = 0; j < data.odf.size(); ++j)
             {
                 tipl::vector<3,float> from(voxel.ti.vertices[j]);
                 from.rotate(data.jacobian);
                 from.normalize();
-                if(voxel.r2_weighted)
+                if(!sinc_table.empty())
+                    for (unsigned int i = 0; i < data.space.size(); ++i,++index)
+                        sinc_ql_[index] = sinc_value(q_vectors_time[i]*from);
+                else if(voxel.r2_weighted)
                     for (unsigned int i = 0; i < data.space.size(); ++i,++index)
                         sinc_ql_[index] = base_function(q_vectors_time[i]*from);
                 else
@@ -59,6 +143,21 @@ public:
             tipl::mat::vector_product(&*sinc_ql.begin(),&*data.space.begin(),&*data.odf.begin(),
                                     tipl::dyndim(uint32_t(data.odf.size()),uint32_t(data.space.size())));
     }
+    virtual void run_block(Voxel& voxel, std::vector<VoxelData>& block,size_t count)
+    {
+        if(voxel.qsdr || !voxel.grad_dev.empty() || count < 2)
+        {
+            BaseProcess::run_block(voxel,block,count);
+            return;
+        }
+        if(voxel.b0_index == 0 && voxel.half_sphere)
+            for (size_t index = 0; index < count; ++index)
+                block[index].space[0] *= 0.5f;
+        // the work space of the first slot holds the transposed tile
+        block_odf_product(&*sinc_ql.begin(),block,count,
+                          uint32_t(block[0].odf.size()),uint32_t(block[0].space.size()),
+                          block[0].space_buf,block[0].odf_buf);
+    }
 };
 
 class dGQI_Recon : public BaseProcess{
@@ -259,7 +358,10 @@ public:
             data.space[0] = 0;
         }
         from.run(voxel,data);
-        std::vector<float> hardi_data(dwi.size()),tmp(dwi.size());
+        std::vector<float>& hardi_data = data.space_buf;
+        std::vector<float>& tmp = data.odf_buf;
+        hardi_data.resize(dwi.size());
+        tmp.resize(dwi.size());
         tipl::mat::vector_product(&*Rt.begin(),&*data.odf.begin(),&*tmp.begin(),tipl::dyndim(dwi.size(),dwi.size()));
         tipl::mat::lu_solve(&*A.begin(),&*piv.begin(),&*tmp.begin(),&*hardi_data.begin(),tipl::dyndim(dwi.size(),dwi.size()));
         for(unsigned int index = 0;index < dwi.size();++index)
@@ -472,14 +574,13 @@ public:
         if(!voxel.output_rdi)
             return;
         float last_value = 0;
-        std::vector<float> rdi_values(rdi.size());
+        data.rdi.resize(rdi.size());
         for(unsigned int index = 0;index < rdi.size();++index)
         {
             // force incremental
-            rdi_values[index] = std::max<float>(last_value,tipl::vec::dot(rdi[index].begin(),rdi[index].end(),data.space.begin()));
-            last_value = rdi_values[index];
+            data.rdi[index] = std::max<float>(last_value,tipl::vec::dot(rdi[index].begin(),rdi[index].end(),data.space.begin()));
+            last_value = data.rdi[index];
         }
-        data.rdi.swap(rdi_values);
     }
 };
 #endif//DDI_PROCESS_HPP
@@ -35,11 +35,28 @@ void ImageModel::calculate_dwi_sum(void)
 {
     dwi_sum.clear();
     dwi_sum.resize(voxel.dim);
-    tipl::par_for(dwi_sum.size(),[&](unsigned int pos)
+    if(src_stream.get())
     {
-        for (unsigned int index = 0;index < src_dwi_data.size();++index)
-            dwi_sum[pos] += src_dwi_data[index][pos];
-    });
+        int thickness = int(slab_thickness());
+        for(int z = 0;z < voxel.dim.depth();z += thickness)
+        {
+            int z_to = std::min<int>(z+thickness,voxel.dim.depth());
+            if(!load_slab(z,z_to))
+                break;
+            float* out = &dwi_sum[0]+size_t(z)*voxel.dim.plane_size();
+            tipl::par_for(size_t(z_to-z)*voxel.dim.plane_size(),[&](size_t pos)
+            {
+                for (unsigned int index = 0;index < src_dwi_data.size();++index)
+                    out[pos] += src_dwi_data[index][pos];
+            });
+        }
+    }
+    else
+        tipl::par_for(dwi_sum.size(),[&](unsigned int pos)
+        {
+            for (unsigned int index = 0;index < src_dwi_data.size();++index)
+                dwi_sum[pos] += src_dwi_data[index][pos];
+        });
 
     float max_value = *std::max_element(dwi_sum.begin(),dwi_sum.end());
     float min_value = max_value;
@@ -78,19 +95,6 @@ typedef boost::mpl::vector<
 > check_btable_process;
 
 
-void flip_fib_dir(std::vector<tipl::vector<3> >& fib_dir,const unsigned char* order)
-{
-    for(int j = 0;j < fib_dir.size();++j)
-    {
-        fib_dir[j] = tipl::vector<3>(fib_dir[j][order[0]],fib_dir[j][order[1]],fib_dir[j][order[2]]);
-        if(order[3])
-            fib_dir[j][0] = -fib_dir[j][0];
-        if(order[4])
-            fib_dir[j][1] = -fib_dir[j][1];
-        if(order[5])
-            fib_dir[j][2] = -fib_dir[j][2];
-    }
-}
 void ImageModel::flip_b_table(const unsigned char* order)
 {
     for(unsigned int index = 0;index < src_bvectors.size();++index)
@@ -166,12 +170,24 @@ std::string ImageModel::check_b_table(void)
     float otsu = tipl::segmentation::otsu_threshold(fib_fa[0])*0.6;
     float cur_score = evaluate_fib(voxel.dim,otsu,fib_fa,[&](int pos,char fib){return fib_dir[fib][pos];}).first;
     result[0] = cur_score;
-    for(int i = 1;i < 24;++i)// 0 is the current score
+    // candidates are scored concurrently, each permuting and flipping the directions on the fly
+    tipl::par_for(23,[&](int j)
     {
-        auto new_dir(fib_dir);
-        flip_fib_dir(new_dir[0],order[i]);
-        result[i] = evaluate_fib(voxel.dim,otsu,fib_fa,[&](int pos,char fib){return new_dir[fib][pos];}).first;
-    }
+        int i = j+1;// 0 is the current score
+        const unsigned char* o = order[i];
+        result[i] = evaluate_fib(voxel.dim,otsu,fib_fa,[&](int pos,char fib)
+        {
+            const tipl::vector<3>& d = fib_dir[fib][pos];
+            tipl::vector<3> v(d[o[0]],d[o[1]],d[o[2]]);
+            if(o[3])
+                v[0] = -v[0];
+            if(o[4])
+                v[1] = -v[1];
+            if(o[5])
+                v[2] = -v[2];
+            return v;
+        }).first;
+    });
     int best = std::max_element(result,result+24)-result;
 
     if(result[best] > cur_score)
@@ -974,14 +990,103 @@ void ImageModel::get_report(std::string& report)
     report = out.str();
 }
 
+// The reconstructed maps and ODFs are kept in memory until Voxel::end writes
+// them, so they take their share of max_memory before the DWI slabs do.
+size_t ImageModel::output_size(void) const
+{
+    size_t voxel_count = voxel.dim.size();
+    size_t mask_count = voxel_count;
+    if(voxel.mask.size() == voxel_count)
+        mask_count = size_t(std::count_if(voxel.mask.begin(),voxel.mask.end(),[](unsigned char v){return v != 0;}));
+    // fa and direction index of each fiber, plus a few scalar maps such as gfa, iso, and the DTI indices
+    size_t bytes = voxel_count*(voxel.max_fiber_number*(sizeof(float)+sizeof(short))+8*sizeof(float));
+    if(voxel.output_odf)
+        bytes += mask_count*voxel.ti.half_vertices_count*sizeof(float);
+    return bytes;
+}
+
+unsigned int ImageModel::slab_thickness(void) const
+{
+    size_t slice_bytes = src_dwi_data.size()*voxel.dim.plane_size()*sizeof(unsigned short);
+    size_t budget = max_memory*size_t(1024*1024);
+    size_t output_bytes = output_size();
+    budget = budget > output_bytes ? budget-output_bytes : 0;
+    size_t thickness = budget/std::max<size_t>(1,slice_bytes);
+    return uint32_t(std::min<size_t>(std::max<size_t>(1,thickness),size_t(voxel.dim.depth())));
+}
+
+bool ImageModel::load_slab(int z_from,int z_to)
+{
+    size_t from = size_t(z_from)*voxel.dim.plane_size();
+    size_t count = size_t(z_to-z_from)*voxel.dim.plane_size();
+    slab_buffer.resize(src_dwi_data.size());
+    for (unsigned int index = 0;index < src_dwi_data.size();++index)
+    {
+        slab_buffer[index].resize(count);
+        if(!src_stream->read_image(index,from,count,&slab_buffer[index][0]))
+            return false;
+        src_dwi_data[index] = &slab_buffer[index][0];
+    }
+    // the processes subtract dwi_offset from whole-volume voxel indices
+    voxel.dwi_offset = from;
+    if(voxel.dwi_data.size() == voxel.dwi_src_index.size())
+        for (unsigned int index = 0;index < voxel.dwi_data.size();++index)
+            voxel.dwi_data[index] = src_dwi_data[voxel.dwi_src_index[index]];
+    return true;
+}
+
 bool ImageModel::load_from_file(const char* dwi_file_name)
 {
     file_name = dwi_file_name;
+    src_stream.reset();
+    slab_buffer.clear();
+    voxel.dwi_offset = 0;
+    if(max_memory)
+    {
+        // The uncompressed size comes from the block index or the gzip footer without
+        // inflating the file. Streaming needs an uncompressed or block-gzip SRC file:
+        // a sequential gzip file would be inflated from the start for every slab.
+        gz_istream probe;
+        if(!probe.open(dwi_file_name))
+        {
+            error_msg = "Cannot open file";
+            return false;
+        }
+        bool stream_src = probe.size() > max_memory*size_t(1024*1024);
+        bool indexed = probe.random_access();
+        probe.close();
+        if(stream_src && !indexed)
+        {
+            error_msg = "The SRC file exceeds max_memory, but a sequential gzip file cannot be streamed. Decompress it to .src or save it again with this version.";
+            return false;
+        }
+        if(stream_src)
+        {
+            // scanning the table of contents only inflates the blocks that hold matrix headers
+            std::shared_ptr<src_slab_reader> stream(new src_slab_reader);
+            if(!stream->open(dwi_file_name))
+            {
+                error_msg = "Cannot open file";
+                return false;
+            }
+            if(stream->image_bytes() > max_memory*size_t(1024*1024))
+            {
+                src_stream = stream;
+                return load_src(*src_stream);
+            }
+        }
+    }
     if (!mat_reader.load_from_file(dwi_file_name))
     {
         error_msg = "Cannot open file";
         return false;
     }
+    return load_src(mat_reader);
+}
+
+template<class reader_type>
+bool ImageModel::load_src(reader_type& mat_reader)
+{
     unsigned int row,col;
 
     const unsigned short* dim_ptr = 0;
@@ -1034,7 +1139,8 @@ bool ImageModel::load_from_file(const char* dwi_file_name)
         get_report(voxel.report);
 
     src_dwi_data.resize(src_bvalues.size());
-    for (unsigned int index = 0;index < src_bvalues.size();++index)
+    // streamed images are read a slab at a time in load_slab
+    for (unsigned int index = 0;index < src_bvalues.size() && !src_stream.get();++index)
     {
         std::ostringstream out;
         out << "image" << index;
@@ -1076,7 +1182,7 @@ bool ImageModel::load_from_file(const char* dwi_file_name)
     else
         voxel.calculate_mask(dwi_sum);
     voxel.steps += "[Step T2][Reconstruction] open ";
-    voxel.steps += QFileInfo(dwi_file_name).fileName().toStdString();
+    voxel.steps += QFileInfo(file_name.c_str()).fileName().toStdString();
     voxel.steps += "\n";
     return true;
 }
@@ -226,6 +226,46 @@ void distortion_estimate(const image_type& v1,const image_type& v2,
     std::cout << "end" << std::endl;
 }
 
+// reads a SRC file matrix by matrix without loading the DWI images,
+// which are then read a block of slices at a time
+class src_slab_reader : public gz_mat_lazy_read{
+    static bool is_image(const std::string& name)
+    {
+        return name.length() > 5 && name.compare(0,5,"image") == 0 &&
+               std::all_of(name.begin()+5,name.end(),[](char ch){return ch >= '0' && ch <= '9';});
+    }
+protected:
+    virtual bool keep_on_disk(const std::string& name) const{return is_image(name);}
+public:
+    bool open(const char* file_name)
+    {
+        return load_from_file(file_name);
+    }
+    // read count elements of image<index> starting at element from
+    bool read_image(unsigned int index,size_t from,size_t count,unsigned short* buf)
+    {
+        std::ostringstream out;
+        out << "image" << index;
+        auto iter = name_table.find(out.str());
+        if(iter == name_table.end())
+            return false;
+        const matrix_info& info = dataset[iter->second];
+        if(info.element_size() != sizeof(unsigned short) || from+count > info.size())
+            return false;
+        std::lock_guard<std::mutex> lock(read_lock);
+        in.seek(long(info.offset+from*sizeof(unsigned short)));
+        return in.read(buf,count*sizeof(unsigned short));
+    }
+    size_t image_bytes(void) const
+    {
+        size_t sum = 0;
+        for(const auto& each : dataset)
+            if(is_image(each.name))
+                sum += each.size()*each.element_size();
+        return sum;
+    }
+};
+
 struct ImageModel
 {
 public:
@@ -243,6 +283,14 @@ public:
 public:
     std::vector<float> src_bvalues;
     std::vector<const unsigned short*> src_dwi_data;
+public: // slab streaming for SRC files larger than max_memory
+    size_t max_memory = 0; // in MB, 0 loads the whole SRC file
+    std::shared_ptr<src_slab_reader> src_stream;
+    std::vector<std::vector<unsigned short> > slab_buffer;
+    bool load_slab(int z_from,int z_to);
+    size_t output_size(void) const;
+    unsigned int slab_thickness(void) const;
+public:
     tipl::image<float,3> dwi_sum;
     tipl::image<unsigned char, 3>dwi;
     std::shared_ptr<ImageModel> study_src;
@@ -281,6 +329,8 @@ public:
     bool command(std::string cmd,std::string param = "");
 public:
     bool load_from_file(const char* dwi_file_name);
+    template<class reader_type>
+    bool load_src(reader_type& reader);
     void save_fib(const std::string& ext);
     void save_to_file(gz_mat_write& mat_writer);
     bool save_to_nii(const char* nifti_file_name) const;
@@ -304,6 +354,13 @@ public:
             begin_prog("Initialization");
             // Copy SRC b-table to voxel b-table and sort it
             voxel.load_from_src(*this);
+            voxel.slab_thickness = 0;
+            voxel.load_slab = nullptr;
+            if(src_stream.get())
+            {
+                voxel.slab_thickness = slab_thickness();
+                voxel.load_slab = [this](int z_from,int z_to){return load_slab(z_from,z_to);};
+            }
             voxel.CreateProcesses<ProcessType>();
             voxel.init();
             if(prog_aborted())
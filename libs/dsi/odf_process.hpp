@@ -1,5 +1,6 @@
 #ifndef ODF_TRANSFORMATION_PROCESS_HPP
 #define ODF_TRANSFORMATION_PROCESS_HPP
+#include <limits>
 #include <boost/math/special_functions/sinc.hpp>
 #include "basic_process.hpp"
 #include "basic_voxel.hpp"
@@ -11,7 +12,19 @@ public:
     {
         data.space.resize(voxel.dwi_data.size());
         for (unsigned int index = 0; index < data.space.size(); ++index)
-            data.space[index] = voxel.dwi_data[index][data.voxel_index];
+            data.space[index] = voxel.dwi_data[index][data.voxel_index-voxel.dwi_offset];
+    }
+    virtual void run_block(Voxel& voxel, std::vector<VoxelData>& block,size_t count)
+    {
+        // gather DWI by DWI so that each image is read along consecutive masked voxels
+        for (size_t v = 0; v < count; ++v)
+            block[v].space.resize(voxel.dwi_data.size());
+        for (unsigned int index = 0; index < voxel.dwi_data.size(); ++index)
+        {
+            const unsigned short* I = voxel.dwi_data[index];
+            for (size_t v = 0; v < count; ++v)
+                block[v].space[index] = I[block[v].voxel_index-voxel.dwi_offset];
+        }
     }
     virtual void end(Voxel&,gz_mat_write&) {}
 };
@@ -124,9 +137,9 @@ public:
             voxel.bvalues = old_bvalues;
             voxel.bvectors = old_bvectors;
         }
-        std::vector<float> new_data(new_q_count);
-        data.space.swap(new_data);
-        tipl::mat::vector_product(trans.begin(),new_data.begin(),data.space.begin(),tipl::dyndim(new_q_count,old_q_count));
+        data.space_buf.resize(new_q_count);
+        data.space.swap(data.space_buf);
+        tipl::mat::vector_product(trans.begin(),data.space_buf.begin(),data.space.begin(),tipl::dyndim(new_q_count,old_q_count));
     }
 };
 
@@ -152,6 +165,57 @@ struct GeneralizedFA
     }
 };
 
+// Quantized ODF block: each ODF (one column of odf_size values) is stored as
+// 8- or 16-bit integers q with a per-voxel offset and step in "odfq#_range"
+// (2 floats per voxel), decoded as offset + q*step. The offset is the ODF
+// minimum, so zero ODFs stay exactly zero, and the maximum error is half a
+// step (up to float rounding): (max-min)/510 for 8 bits and (max-min)/131070
+// for 16 bits.
+template<class value_type>
+void write_quantized_odf(gz_mat_write& mat_writer,unsigned int index,
+                         const std::vector<float>& odf,unsigned int odf_size)
+{
+    const float levels = float(std::numeric_limits<value_type>::max());
+    size_t voxel_count = odf.size()/odf_size;
+    std::vector<value_type> q(odf.size());
+    std::vector<float> range(voxel_count*2);
+    tipl::par_for(voxel_count,[&](size_t i)
+    {
+        const float* from = &odf[0] + i*odf_size;
+        value_type* to = &q[0] + i*odf_size;
+        auto min_max = std::minmax_element(from,from+odf_size);
+        float offset = *min_max.first;
+        float step = (*min_max.second-offset)/levels;
+        range[i*2] = offset;
+        range[i*2+1] = step;
+        if(step == 0.0f)
+            return;
+        for(unsigned int j = 0;j < odf_size;++j)
+            to[j] = value_type(std::min<float>(levels,std::round((from[j]-offset)/step)));
+    });
+    std::ostringstream out1,out2;
+    out1 << "odfq" << index;
+    out2 << "odfq" << index << "_range";
+    mat_writer.write(out1.str().c_str(),q,odf_size);
+    mat_writer.write(out2.str().c_str(),range,2);
+}
+inline void write_odf_block(Voxel& voxel,gz_mat_write& mat_writer,unsigned int index,const std::vector<float>& odf)
+{
+    if(voxel.odf_bits == 8)
+    {
+        write_quantized_odf<unsigned char>(mat_writer,index,odf,voxel.ti.half_vertices_count);
+        return;
+    }
+    if(voxel.odf_bits == 16)
+    {
+        write_quantized_odf<unsigned short>(mat_writer,index,odf,voxel.ti.half_vertices_count);
+        return;
+    }
+    std::ostringstream out;
+    out << "odf" << index;
+    mat_writer.write(out.str().c_str(),odf,voxel.ti.half_vertices_count);
+}
+
 const unsigned int odf_block_size = 20000;
 struct OutputODF : public BaseProcess
 {
@@ -223,9 +287,7 @@ public:
             for (unsigned int index = 0;index < odf_data.size();++index)
             {
                 tipl::divide_constant(odf_data[index],voxel.z0);
-                std::ostringstream out;
-                out << "odf" << index;
-                mat_writer.write(out.str().c_str(),odf_data[index],voxel.ti.half_vertices_count);
+                write_odf_block(voxel,mat_writer,index,odf_data[index]);
             }
             odf_data.clear();
         }
@@ -286,11 +348,7 @@ public:
         {
             set_title("Output ODFs");
             for (unsigned int index = 0;index < voxel.template_odfs.size();++index)
-            {
-                std::ostringstream out;
-                out << "odf" << index;
-                mat_writer.write(out.str().c_str(),voxel.template_odfs[index],voxel.ti.half_vertices_count);
-            }
+                write_odf_block(voxel,mat_writer,index,voxel.template_odfs[index]);
         }
         mat_writer.write("trans",voxel.trans_to_mni,4,4);
     }
@@ -573,25 +631,28 @@ public:
 
 struct ODFShaping
 {
-    std::vector<std::vector<unsigned int> > shape_list;
+    // removal order of each direction, stored row by row
+    std::vector<uint16_t> shape_list;
+    unsigned int half_odf_size = 0;
     void init(Voxel& voxel)
     {
-        unsigned int half_odf_size = voxel.ti.half_vertices_count;
-        shape_list.clear();
+        half_odf_size = voxel.ti.half_vertices_count;
+        shape_list.resize(size_t(half_odf_size)*half_odf_size);
         for (unsigned int i = 0;i < half_odf_size;++i)
         {
             std::vector<float> cos_value(half_odf_size);
             for(unsigned int j = 0;j < half_odf_size;++j)
                 cos_value[i] = std::fabs(voxel.ti.vertices_cos(i,j));
-            shape_list.push_back(tipl::arg_sort(cos_value,std::greater<float>()));
+            auto order = tipl::arg_sort(cos_value,std::greater<float>());
+            std::copy(order.begin(),order.end(),shape_list.begin()+size_t(i)*half_odf_size);
         }
     }
     void shape(std::vector<float>& odf,uint16_t dir)
     {
         float cur_max = odf[dir];
         odf[dir] = 0.0f;
-        const std::vector<unsigned int>& remove_list = shape_list[dir];
-        for (unsigned int index = 1;index < remove_list.size();++index)
+        const uint16_t* remove_list = &shape_list[size_t(dir)*half_odf_size];
+        for (unsigned int index = 1;index < half_odf_size;++index)
         {
             unsigned int pos = remove_list[index];
             cur_max = std::min<float>(odf[pos],cur_max);
@@ -599,14 +660,43 @@ struct ODFShaping
         }
     }
 };
+
+// keeps the largest values in descending order in fixed-size arrays.
+// A value equal to a kept one replaces its index, as a map keyed by value would.
+inline void insert_peak(float value,uint16_t index,
+                        float* top_value,uint16_t* top_index,unsigned int& size,unsigned int max_size)
+{
+    unsigned int pos = 0;
+    while(pos < size && top_value[pos] > value)
+        ++pos;
+    if(pos < size && top_value[pos] == value)
+    {
+        top_index[pos] = index;
+        return;
+    }
+    if(pos >= max_size)
+        return;
+    if(size < max_size)
+        ++size;
+    for(unsigned int j = size-1;j > pos;--j)
+    {
+        top_value[j] = top_value[j-1];
+        top_index[j] = top_index[j-1];
+    }
+    top_value[pos] = value;
+    top_index[pos] = index;
+}
+
 struct SearchLocalMaximum
 {
-    std::vector<std::vector<unsigned short> > neighbor;
+    // neighbors of each vertex in rows of neighbor_size, padded with the vertex itself
+    std::vector<uint16_t> neighbor;
+    unsigned int neighbor_size = 0;
     void init(Voxel& voxel)
     {
         unsigned int half_odf_size = voxel.ti.half_vertices_count;
         unsigned int faces_count = uint32_t(voxel.ti.faces.size());
-        neighbor.resize(voxel.ti.half_vertices_count);
+        std::vector<std::vector<uint16_t> > neighbor_list(half_odf_size);
         for (unsigned int index = 0;index < faces_count;++index)
         {
             unsigned short i1 = voxel.ti.faces[index][0];
@@ -618,32 +708,42 @@ struct SearchLocalMaximum
                 i2 -= half_odf_size;
             if (i3 >= half_odf_size)
                 i3 -= half_odf_size;
-            neighbor[i1].push_back(i2);
-            neighbor[i1].push_back(i3);
-            neighbor[i2].push_back(i1);
-            neighbor[i2].push_back(i3);
-            neighbor[i3].push_back(i1);
-            neighbor[i3].push_back(i2);
+            neighbor_list[i1].push_back(i2);
+            neighbor_list[i1].push_back(i3);
+            neighbor_list[i2].push_back(i1);
+            neighbor_list[i2].push_back(i3);
+            neighbor_list[i3].push_back(i1);
+            neighbor_list[i3].push_back(i2);
+        }
+        neighbor_size = 0;
+        for (auto& nei : neighbor_list)
+        {
+            std::sort(nei.begin(),nei.end());
+            nei.erase(std::unique(nei.begin(),nei.end()),nei.end());
+            neighbor_size = std::max<unsigned int>(neighbor_size,uint32_t(nei.size()));
+        }
+        neighbor.resize(size_t(half_odf_size)*neighbor_size);
+        for (unsigned int index = 0;index < half_odf_size;++index)
+        {
+            auto iter = std::copy(neighbor_list[index].begin(),neighbor_list[index].end(),
+                                  neighbor.begin()+size_t(index)*neighbor_size);
+            std::fill(iter,neighbor.begin()+size_t(index+1)*neighbor_size,uint16_t(index));
         }
     }
-    void search(const std::vector<float>& old_odf,std::map<float,unsigned short,std::greater<float> >& max_table)
+    // a vertex is a peak if no neighbor has a larger value
+    void search(const std::vector<float>& odf,
+                float* top_value,uint16_t* top_index,unsigned int& size,unsigned int max_size) const
     {
-        max_table.clear();
-        for (uint16_t index = 0;index < neighbor.size();++index)
+        const float* value = &odf[0];
+        const uint16_t* nei = &neighbor[0];
+        unsigned int vertex_count = uint32_t(odf.size());
+        for (unsigned int index = 0;index < vertex_count;++index,nei += neighbor_size)
         {
-            float value = old_odf[index];
-            bool is_max = true;
-            std::vector<uint16_t>& nei = neighbor[index];
-            for (unsigned int j = 0;j < nei.size();++j)
-            {
-                if (value < old_odf[nei[j]])
-                {
-                    is_max = false;
-                    break;
-                }
-            }
-            if (is_max)
-                max_table[value] = index;
+            float max_nei = value[nei[0]];
+            for (unsigned int j = 1;j < neighbor_size;++j)
+                max_nei = std::max<float>(max_nei,value[nei[j]]);
+            if (value[index] >= max_nei)
+                insert_peak(value[index],uint16_t(index),top_value,top_index,size,max_size);
         }
     }
 };
@@ -665,28 +765,27 @@ public:
     virtual void run(Voxel& voxel,VoxelData& data)
     {
         data.min_odf = *std::min_element(data.odf.begin(),data.odf.end());
-        std::map<float,unsigned short,std::greater<float> > max_table;
-        lm.search(data.odf,max_table);
+        // peak values are kept in fa and shifted by min_odf at the end
+        float* top_value = &data.fa[0];
+        uint16_t* top_index = &data.dir_index[0];
+        unsigned int size = 0;
+        lm.search(data.odf,top_value,top_index,size,voxel.max_fiber_number);
         if(voxel.odf_resolving)
         {
-            std::vector<float> odf(data.odf);
+            std::vector<float>& odf = data.odf_buf;
+            odf = data.odf;
             for (unsigned int index = 0;index < 3;++index)
             {
                 uint16_t max_dir = uint16_t(std::max_element(odf.begin(),odf.end())-odf.begin());
                 if(odf[max_dir] == 0.0f)
                     break;
                 if(index)
-                    max_table[data.odf[max_dir]] = max_dir;
+                    insert_peak(data.odf[max_dir],max_dir,top_value,top_index,size,voxel.max_fiber_number);
                 shaping.shape(odf,max_dir);
             }
         }
-        auto iter = max_table.begin();
-        auto end = max_table.end();
-        for (unsigned int index = 0;iter != end && index < voxel.max_fiber_number;++index,++iter)
-        {
-            data.dir_index[index] = iter->second;
-            data.fa[index] = iter->first - data.min_odf;
-        }
+        for (unsigned int index = 0;index < size;++index)
+            data.fa[index] -= data.min_odf;
     }
 };
 
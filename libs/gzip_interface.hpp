@@ -5,13 +5,201 @@
 #else
 #include "zlib.h"
 #endif
+#include <cstring>
+#include <future>
+#include <memory>
+#include <map>
+#include <mutex>
 #include "tipl/tipl.hpp"
 #include "prog_interface_static_link.h"
 extern bool prog_aborted_;
+
+// SRC and FIB files are written as a series of independently deflated gzip
+// members. Each member carries its own size in a "DS" extra field, so the
+// file is still a valid (multi-member) gzip file for zlib, while the reader
+// can index the members, seek in constant time, and inflate them in parallel.
+struct gz_block{
+    static const size_t block_size = 4194304; // 4mb uncompressed data per member
+    static const size_t header_size = 20;
+    static const size_t footer_size = 8;
+    static bool is_block_file(const std::string& filename)
+    {
+        auto ends_with = [&filename](const char* ext)
+        {
+            std::string e(ext);
+            return filename.length() > e.length() &&
+                   filename.compare(filename.length()-e.length(),e.length(),e) == 0;
+        };
+        return ends_with(".src.gz") || ends_with(".fib.gz");
+    }
+    static unsigned int get_uint32(const unsigned char* p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+    static void set_uint32(unsigned char* p,unsigned int value)
+    {
+        p[0] = uint8_t(value);
+        p[1] = uint8_t(value >> 8);
+        p[2] = uint8_t(value >> 16);
+        p[3] = uint8_t(value >> 24);
+    }
+    // returns the total member size, or 0 if the header is not a block header
+    static size_t parse_header(const unsigned char* h)
+    {
+        if(h[0] != 31 || h[1] != 139 || h[2] != 8 || !(h[3] & 4) ||
+           h[10] != 8 || h[11] != 0 || h[12] != 'D' || h[13] != 'S' || h[14] != 4 || h[15] != 0)
+            return 0;
+        return get_uint32(h+16);
+    }
+    static bool compress(const char* buf,size_t size,std::vector<char>& out)
+    {
+        z_stream s;
+        std::memset(&s,0,sizeof(s));
+        if(deflateInit2(&s,Z_DEFAULT_COMPRESSION,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        out.resize(header_size+deflateBound(&s,uLong(size))+footer_size);
+        s.next_in = (Bytef*)buf;
+        s.avail_in = uInt(size);
+        s.next_out = (Bytef*)&out[header_size];
+        s.avail_out = uInt(out.size()-header_size-footer_size);
+        int ret = deflate(&s,Z_FINISH);
+        size_t compressed_size = s.total_out;
+        deflateEnd(&s);
+        if(ret != Z_STREAM_END)
+            return false;
+        out.resize(header_size+compressed_size+footer_size);
+        unsigned char* h = (unsigned char*)&out[0];
+        const unsigned char header[16] = {31,139,8,4,0,0,0,0,0,255,8,0,'D','S',4,0};
+        std::copy(header,header+16,h);
+        set_uint32(h+16,uint32_t(out.size()));
+        unsigned char* f = h+out.size()-footer_size;
+        set_uint32(f,uint32_t(crc32(0,(const Bytef*)buf,uInt(size))));
+        set_uint32(f+4,uint32_t(size));
+        return true;
+    }
+    static bool decompress(const char* member,size_t member_size,char* out,size_t out_size)
+    {
+        z_stream s;
+        std::memset(&s,0,sizeof(s));
+        if(inflateInit2(&s,-15) != Z_OK)
+            return false;
+        s.next_in = (Bytef*)member+header_size;
+        s.avail_in = uInt(member_size-header_size-footer_size);
+        s.next_out = (Bytef*)out;
+        s.avail_out = uInt(out_size);
+        int ret = inflate(&s,Z_FINISH);
+        bool result = (ret == Z_STREAM_END && s.total_out == out_size);
+        inflateEnd(&s);
+        // the member footer holds the crc32 and size of the uncompressed data
+        const unsigned char* f = (const unsigned char*)member+member_size-footer_size;
+        return result &&
+               get_uint32(f+4) == uint32_t(out_size) &&
+               get_uint32(f) == uint32_t(crc32(0,(const Bytef*)out,uInt(out_size)));
+    }
+};
+
 class gz_istream{
     size_t size_;
     std::ifstream in;
     gzFile handle;
+private:// block gzip index
+    bool block_mode = false;
+    size_t pos = 0;
+    std::vector<size_t> block_file_pos,block_file_size,block_pos; // block_pos has one extra end position
+    size_t cached_block = size_t(-1);
+    std::vector<char> cached_data;
+    bool build_index(void)
+    {
+        block_file_pos.clear();
+        block_file_size.clear();
+        block_pos.clear();
+        in.seekg(0,std::ios::end);
+        size_t file_size = size_t(in.tellg());
+        size_t file_pos = 0,data_pos = 0;
+        while(file_pos < file_size)
+        {
+            unsigned char h[gz_block::header_size],f[4];
+            in.seekg(std::streamoff(file_pos),std::ios::beg);
+            in.read((char*)h,gz_block::header_size);
+            size_t member_size = in ? gz_block::parse_header(h) : 0;
+            if(member_size < gz_block::header_size+gz_block::footer_size ||
+               file_pos+member_size > file_size)
+                return false;
+            in.seekg(std::streamoff(file_pos+member_size-4),std::ios::beg);
+            in.read((char*)f,4);
+            if(!in)
+                return false;
+            block_file_pos.push_back(file_pos);
+            block_file_size.push_back(member_size);
+            block_pos.push_back(data_pos);
+            file_pos += member_size;
+            data_pos += gz_block::get_uint32(f);
+        }
+        block_pos.push_back(data_pos);
+        in.clear();
+        size_ = data_pos;
+        pos = 0;
+        cached_block = size_t(-1);
+        return !block_file_pos.empty();
+    }
+    size_t block_length(size_t index) const{return block_pos[index+1]-block_pos[index];}
+    bool read_blocks(size_t from,size_t to,char* out) // decompress whole blocks [from,to) into out
+    {
+        size_t file_from = block_file_pos[from];
+        std::vector<char> compressed(block_file_pos[to-1]+block_file_size[to-1]-file_from);
+        in.seekg(std::streamoff(file_from),std::ios::beg);
+        if(!in.read(&compressed[0],compressed.size()))
+            return false;
+        std::vector<char> result(to-from);
+        tipl::par_for(to-from,[&](size_t i)
+        {
+            size_t b = from+i;
+            result[i] = gz_block::decompress(&compressed[0]+block_file_pos[b]-file_from,block_file_size[b],
+                                      out+block_pos[b]-block_pos[from],block_length(b));
+        });
+        return std::find(result.begin(),result.end(),0) == result.end();
+    }
+    bool read_block_mode(char* buf,size_t buf_size)
+    {
+        if(pos+buf_size > size_)
+            return false;
+        size_t b = size_t(std::upper_bound(block_pos.begin(),block_pos.end(),pos)-block_pos.begin())-1;
+        const size_t batch = 32;
+        while(buf_size)
+        {
+            if(pos == block_pos[b] && block_length(b) <= buf_size)
+            {
+                // inflate whole blocks straight into the output buffer
+                size_t to = b;
+                while(to < block_file_pos.size() && to-b < batch && block_pos[to+1]-pos <= buf_size)
+                    ++to;
+                if(!read_blocks(b,to,buf))
+                    return false;
+                size_t length = block_pos[to]-pos;
+                buf += length;
+                buf_size -= length;
+                pos += length;
+                b = to;
+                continue;
+            }
+            if(cached_block != b)
+            {
+                cached_data.resize(block_length(b));
+                cached_block = size_t(-1);
+                if(!read_blocks(b,b+1,&cached_data[0]))
+                    return false;
+                cached_block = b;
+            }
+            size_t offset = pos-block_pos[b];
+            size_t length = std::min<size_t>(buf_size,block_length(b)-offset);
+            std::copy(cached_data.begin()+long(offset),cached_data.begin()+long(offset+length),buf);
+            buf += length;
+            buf_size -= length;
+            pos += length;
+            ++b;
+        }
+        return true;
+    }
     bool is_gz(const char* file_name)
     {
         std::string filename = file_name;
@@ -44,6 +232,17 @@ public:
         }
         if(is_gz(file_name))
         {
+            block_mode = false;
+            unsigned char h[gz_block::header_size];
+            if(in && in.read((char*)h,gz_block::header_size) && gz_block::parse_header(h))
+            {
+                if(build_index())
+                {
+                    block_mode = true;
+                    return true;
+                }
+                in.clear();
+            }
             in.close();
             if(size_ > gz_size) // size > 4G
                 size_ = size_*2;
@@ -62,6 +261,15 @@ public:
             check_prog(99,100);
         if(prog_aborted())
             return false;
+        if(block_mode)
+        {
+            if(!read_block_mode((char*)buf,buf_size))
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
         if(handle)
         {
 
@@ -91,8 +299,14 @@ public:
             }
         return false;
     }
-    void seek(long pos)
+    void seek(long pos_)
     {
+        if(block_mode)
+        {
+            pos = size_t(pos_);
+            return;
+        }
+        long pos = pos_;
         if(handle)
         {
             if(gzseek(handle,pos,SEEK_SET) == -1)
@@ -109,19 +323,27 @@ public:
             gzclose(handle);
             handle = 0;
         }
-        if(in)
+        if(in.is_open())
             in.close();
+        in.clear();
+        block_mode = false;
+        cached_data.clear();
+        cached_block = size_t(-1);
         check_prog(0,0);
     }
     size_t cur(void)
     {
+        if(block_mode)
+            return pos;
         return handle ? (size_t)gztell(handle):(size_t)in.tellg();
     }
     size_t size(void)
     {
         return size_;
     }
-    bool good(void) const {return handle ? !gzeof(handle):in.good();}
+    bool good(void) const {return block_mode ? true : (handle ? !gzeof(handle):in.good());}
+    // indexed gzip and uncompressed files can seek backward without inflating from the start
+    bool random_access(void) const {return block_mode || !handle;}
     operator bool() const	{return good();}
     bool operator!() const	{return !good();}
 };
@@ -129,6 +351,60 @@ public:
 class gz_ostream{
     std::ofstream out;
     gzFile handle;
+private:// block gzip
+    bool block_mode = false;
+    bool failed = false; // a compression or write error, reported by close() and good()
+    std::vector<char> buffer;
+    std::future<void> pending; // the previous batch, compressed and written in the background
+    // members per batch, fixed so that the staged data (this batch and the one being
+    // written) stays at 2*8*4mb however many cores compress it
+    static const size_t batch_member_count = 8;
+    size_t batch_size(void) const
+    {
+        return gz_block::block_size*batch_member_count;
+    }
+    void wait_pending(void)
+    {
+        if(pending.valid())
+        {
+            try{
+                pending.get();
+            }
+            catch(...)
+            {
+                failed = true;
+            }
+        }
+    }
+    // compress a batch in parallel as independent members and write them in order,
+    // while the caller fills the next batch
+    void write_blocks(std::vector<char>& data)
+    {
+        wait_pending();
+        std::shared_ptr<std::vector<char> > batch(new std::vector<char>);
+        batch->swap(data);
+        pending = std::async(std::launch::async,[this,batch]()
+        {
+            const char* buf = &(*batch)[0];
+            size_t size = batch->size();
+            size_t block_count = (size+gz_block::block_size-1)/gz_block::block_size;
+            std::vector<std::vector<char> > members(block_count);
+            std::vector<char> result(block_count);
+            tipl::par_for(block_count,[&](size_t i)
+            {
+                size_t from = i*gz_block::block_size;
+                result[i] = gz_block::compress(buf+from,std::min<size_t>(size_t(gz_block::block_size),size-from),members[i]);
+            });
+            for(size_t i = 0;i < block_count;++i)
+            {
+                if(!result[i])
+                    throw std::runtime_error("Cannot output gz file");
+                out.write(&members[i][0],std::streamsize(members[i].size()));
+                if(!out)
+                    throw std::runtime_error("Cannot output gz file");
+            }
+        });
+    }
     bool is_gz(const char* file_name)
     {
         std::string filename = file_name;
@@ -149,8 +425,15 @@ public:
     template<class char_type>
     bool open(const char_type* file_name)
     {
+        failed = false;
         if(is_gz(file_name))
         {
+            block_mode = gz_block::is_block_file(file_name);
+            if(block_mode)
+            {
+                out.open(file_name,std::ios::binary);
+                return out.good();
+            }
             handle = gzopen(file_name, "wb");
             return handle;
         }
@@ -159,6 +442,25 @@ public:
     }
     void write(const void* buf,size_t size)
     {
+        if(block_mode)
+        {
+            if(failed)
+                return;
+            const char* p = (const char*)buf;
+            const size_t batch = batch_size();
+            while(size)
+            {
+                if(buffer.capacity() < batch)
+                    buffer.reserve(batch);
+                size_t length = std::min<size_t>(size,batch-buffer.size());
+                buffer.insert(buffer.end(),p,p+length);
+                p += length;
+                size -= length;
+                if(buffer.size() == batch)
+                    write_blocks(buffer);
+            }
+            return;
+        }
         if(handle)
         {
             const size_t block_size = 524288000;// 500mb
@@ -166,6 +468,7 @@ public:
             {
                 if(gzwrite(handle,buf,block_size) <= 0)
                 {
+                    failed = true;
                     close();
                     throw std::runtime_error("Cannot output gz file");
                 }
@@ -173,23 +476,41 @@ public:
                 buf = (const char*)buf + block_size;
             }
             if(gzwrite(handle,buf,(unsigned int)size) <= 0)
+            {
+                failed = true;
                 close();
+            }
         }
         else
             if(out)
                 out.write((const char*)buf,size);
     }
-    void close(void)
+    // returns false if any data could not be compressed or written
+    bool close(void)
     {
         if(handle)
         {
-            gzclose(handle);
+            if(gzclose(handle) != Z_OK)
+                failed = true;
             handle = 0;
         }
-        if(out)
+        if(block_mode)
+        {
+            if(!failed && out && !buffer.empty())
+                write_blocks(buffer);
+            wait_pending();
+            buffer.clear();
+            block_mode = false;
+        }
+        if(out.is_open())
+        {
             out.close();
+            if(!out)
+                failed = true;
+        }
+        return !failed;
     }
-    bool good(void) const {return handle ? !gzeof(handle):out.good();}
+    bool good(void) const {return !failed && (handle ? !gzeof(handle):out.good());}
     operator bool() const	{return good();}
     bool operator!() const	{return !good();}
 
@@ -200,4 +521,205 @@ typedef tipl::io::nifti_base<gz_istream,gz_ostream> gz_nifti;
 typedef tipl::io::mat_write_base<gz_ostream> gz_mat_write;
 typedef tipl::io::mat_read_base<gz_istream> gz_mat_read;
 
+// reads the table of contents of a MAT file and loads each matrix the first
+// time it is read. Sequential (non-indexed) gzip files cannot seek backward
+// cheaply, and their matrices are loaded during the scan as gz_mat_read does.
+class gz_mat_lazy_read{
+protected:
+    struct matrix_info{
+        std::string name;
+        unsigned int type = 0,rows = 0,cols = 0;
+        size_t offset = 0;
+        bool loaded = false;
+        std::vector<char> data;
+        size_t element_size(void) const
+        {
+            const unsigned char size_table[6] = {8,4,4,2,2,1};
+            unsigned int p = (type/10)%10;
+            return p < 6 ? size_table[p] : 1;
+        }
+        size_t size(void) const{return size_t(rows)*size_t(cols);}
+    };
+    gz_istream in;
+    std::vector<matrix_info> dataset;
+    std::map<std::string,unsigned int> name_table;
+    std::map<std::pair<unsigned int,unsigned int>,std::vector<char> > converted;
+    std::mutex read_lock;
+    // matrices left on disk even when the file has to be read sequentially
+    virtual bool keep_on_disk(const std::string&) const{return false;}
+protected:
+    static unsigned int type_code(const double*){return 0;}
+    static unsigned int type_code(const float*){return 1;}
+    static unsigned int type_code(const int*){return 2;}
+    static unsigned int type_code(const unsigned int*){return 2;}
+    static unsigned int type_code(const short*){return 3;}
+    static unsigned int type_code(const unsigned short*){return 4;}
+    static unsigned int type_code(const unsigned char*){return 5;}
+    static unsigned int type_code(const char*){return 5;}
+    template<class T>
+    static T get_value(const matrix_info& info,size_t index)
+    {
+        const char* p = &info.data[0]+index*info.element_size();
+        switch((info.type/10)%10)
+        {
+            case 0: return T(*reinterpret_cast<const double*>(p));
+            case 1: return T(*reinterpret_cast<const float*>(p));
+            case 2: return T(*reinterpret_cast<const int*>(p));
+            case 3: return T(*reinterpret_cast<const short*>(p));
+            case 4: return T(*reinterpret_cast<const unsigned short*>(p));
+        }
+        return T(*reinterpret_cast<const unsigned char*>(p));
+    }
+    bool load(matrix_info& info)
+    {
+        if(info.loaded)
+            return true;
+        info.data.resize(info.size()*info.element_size());
+        in.seek(long(info.offset));
+        if(!info.data.empty() && !in.read(&info.data[0],info.data.size()))
+        {
+            info.data.clear();
+            return false;
+        }
+        info.loaded = true;
+        return true;
+    }
+public:
+    virtual ~gz_mat_lazy_read(void){}
+    template<class char_type>
+    bool load_from_file(const char_type* file_name)
+    {
+        dataset.clear();
+        name_table.clear();
+        converted.clear();
+        in.close();
+        if(!in.open(file_name))
+            return false;
+        bool load_now = !in.random_access();
+        size_t pos = 0;
+        while(1)
+        {
+            unsigned int header[5];
+            if(!in.read(header,sizeof(header)) || header[4] == 0)
+                break;
+            std::vector<char> name(header[4]);
+            if(!in.read(&name[0],name.size()))
+                break;
+            dataset.push_back(matrix_info());
+            matrix_info& info = dataset.back();
+            info.name = &name[0];
+            info.type = header[0];
+            info.rows = header[1];
+            info.cols = header[2];
+            info.offset = pos+sizeof(header)+name.size();
+            pos = info.offset+info.size()*info.element_size();
+            name_table[info.name] = uint32_t(dataset.size()-1);
+            if(load_now && !keep_on_disk(info.name))
+            {
+                info.loaded = true;
+                info.data.resize(info.size()*info.element_size());
+                if(!info.data.empty() && !in.read(&info.data[0],info.data.size()))
+                    return false;
+            }
+            else
+                in.seek(long(pos));
+        }
+        // reading past the last matrix has closed the stream
+        in.close();
+        return !dataset.empty() && !prog_aborted() && in.open(file_name);
+    }
+    unsigned int size(void) const{return uint32_t(dataset.size());}
+    const std::string& name(unsigned int index) const{return dataset[index].name;}
+    bool has(const char* name) const{return name_table.find(name) != name_table.end();}
+    // true if the matrix is stored as T and can be read without conversion
+    template<class T>
+    bool stored_as(const char* name) const
+    {
+        auto iter = name_table.find(name);
+        return iter != name_table.end() &&
+               (dataset[iter->second].type/10)%10 == type_code(static_cast<const T*>(nullptr));
+    }
+    // matrix dimension from the table of contents, without loading the matrix
+    bool get_size(const char* name,unsigned int& rows,unsigned int& cols) const
+    {
+        auto iter = name_table.find(name);
+        if(iter == name_table.end())
+            return false;
+        rows = dataset[iter->second].rows;
+        cols = dataset[iter->second].cols;
+        return true;
+    }
+    template<class T>
+    bool read(unsigned int index,unsigned int& rows,unsigned int& cols,const T*& ptr)
+    {
+        if(index >= dataset.size())
+            return false;
+        std::lock_guard<std::mutex> lock(read_lock);
+        matrix_info& info = dataset[index];
+        if(!load(info))
+            return false;
+        rows = info.rows;
+        cols = info.cols;
+        unsigned int code = type_code(static_cast<const T*>(nullptr));
+        if((info.type/10)%10 == code)
+        {
+            ptr = info.data.empty() ? nullptr : reinterpret_cast<const T*>(&info.data[0]);
+            return true;
+        }
+        std::vector<char>& buf = converted[std::make_pair(index,code)];
+        if(buf.empty())
+        {
+            buf.resize(std::max<size_t>(1,info.size())*sizeof(T));
+            T* out = reinterpret_cast<T*>(&buf[0]);
+            for(size_t i = 0;i < info.size();++i)
+                out[i] = get_value<T>(info,i);
+        }
+        ptr = reinterpret_cast<const T*>(&buf[0]);
+        return true;
+    }
+    template<class T>
+    bool read(const char* name,unsigned int& rows,unsigned int& cols,const T*& ptr)
+    {
+        auto iter = name_table.find(name);
+        if(iter == name_table.end())
+            return false;
+        return read(iter->second,rows,cols,ptr);
+    }
+    template<class T>
+    void add(const char* name,const T* ptr,unsigned int rows,unsigned int cols)
+    {
+        dataset.push_back(matrix_info());
+        matrix_info& info = dataset.back();
+        info.name = name;
+        info.type = type_code(ptr)*10;
+        info.rows = rows;
+        info.cols = cols;
+        info.loaded = true;
+        info.data.resize(info.size()*sizeof(T));
+        if(!info.data.empty())
+            std::copy(reinterpret_cast<const char*>(ptr),reinterpret_cast<const char*>(ptr+info.size()),info.data.begin());
+        name_table[info.name] = uint32_t(dataset.size()-1);
+    }
+    // copy a matrix to a mat writer with its stored type
+    template<class writer_type>
+    bool write_to(writer_type& out,unsigned int index)
+    {
+        unsigned int rows,cols;
+        const char* name = dataset[index].name.c_str();
+        switch((dataset[index].type/10)%10)
+        {
+            case 0:{const double* p = nullptr;if(!read(index,rows,cols,p)) return false;out.write(name,p,rows,cols);return true;}
+            case 1:{const float* p = nullptr;if(!read(index,rows,cols,p)) return false;out.write(name,p,rows,cols);return true;}
+            case 2:{const int* p = nullptr;if(!read(index,rows,cols,p)) return false;out.write(name,p,rows,cols);return true;}
+            case 3:{const short* p = nullptr;if(!read(index,rows,cols,p)) return false;out.write(name,p,rows,cols);return true;}
+            case 4:{const unsigned short* p = nullptr;if(!read(index,rows,cols,p)) return false;out.write(name,p,rows,cols);return true;}
+        }
+        const unsigned char* p = nullptr;
+        if(!read(index,rows,cols,p))
+            return false;
+        out.write(name,p,rows,cols);
+        return true;
+    }
+};
+
 #endif // GZIP_INTERFACE_HPP
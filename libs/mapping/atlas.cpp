@@ -4,6 +4,7 @@
 #include "libs/gzip_interface.hpp"
 #include <QCoreApplication>
 #include <QDir>
+#include <thread>
 
 void sub2mni(tipl::vector<3>& pos,const tipl::matrix<4,4,float>& trans);
 void mni2sub(tipl::vector<3>& pos,const tipl::matrix<4,4,float>& trans);
@@ -149,6 +150,9 @@ bool atlas::load_from_file(void)
                     out << label_num[i] << " " << labels[i] << std::endl;
             }*/
         }
+        index2label.resize(hist.size());
+        for(unsigned int i = 0;i < label_num.size();++i)
+            index2label[label_num[i]].push_back(i);
     }
     return true;
 }
@@ -181,7 +185,7 @@ bool atlas::is_labeled_as(const tipl::vector<3,float>& mni_space,unsigned int la
         return track[pos];
     }
     int l = I[offset];
-    if(index2label.empty()) // not talairach
+    if(label2index.empty()) // not talairach
         return l == label_num[label_name_index];
 
     // The following is for talairach
@@ -189,6 +193,52 @@ bool atlas::is_labeled_as(const tipl::vector<3,float>& mni_space,unsigned int la
         return false;
     return std::find(index2label[l].begin(),index2label[l].end(),label_name_index) != index2label[l].end();
 }
+void atlas::get_labels(const tipl::vector<3,float>& mni_space,std::vector<unsigned int>& result)
+{
+    result.clear();
+    int offset = get_index(mni_space);
+    if(!offset || offset >= I.size())
+        return;
+    if(is_track)
+    {
+        for(unsigned int i = 0;i < label_num.size() && i < track_base_pos.size();++i)
+            if(track[track_base_pos[i] + offset])
+                result.push_back(i);
+        return;
+    }
+    int l = I[offset];
+    if(l >= 0 && l < index2label.size())
+        result = index2label[l];
+}
+bool atlas::get_label_map(const tipl::image<tipl::vector<3,float>,3>& mni_position,region_label_map& result)
+{
+    result.clear();
+    if(!load_from_file())
+        return false;
+    result.label.resize(mni_position.size(),-1);
+    unsigned int thread_count = std::max<unsigned int>(1,std::thread::hardware_concurrency());
+    std::vector<std::vector<std::pair<unsigned int,std::vector<short> > > > overlap_list(thread_count);
+    std::vector<std::vector<unsigned int> > labels(thread_count);
+    tipl::par_for2(mni_position.size(),[&](unsigned int index,unsigned int id)
+    {
+        get_labels(mni_position[index],labels[id]);
+        if(labels[id].empty())
+            return;
+        if(labels[id].size() == 1)
+        {
+            result.label[index] = int(labels[id][0]);
+            return;
+        }
+        overlap_list[id].push_back(std::make_pair(index,std::vector<short>(labels[id].begin(),labels[id].end())));
+    },thread_count);
+    for(auto& list : overlap_list)
+        for(auto& each : list)
+        {
+            result.label[each.first] = -2-int(result.overlap.size());
+            result.overlap.push_back(std::move(each.second));
+        }
+    return true;
+}
 int atlas::get_track_label(const std::vector<tipl::vector<3> >& points)
 {
     if(I.empty())
@@ -3,6 +3,86 @@
 #include "tipl/tipl.hpp"
 #include <vector>
 #include <string>
+// voxel-to-region table. A voxel in one region stores the region index in
+// label; a voxel shared by several regions stores -2-k, where k points to
+// the sorted region list in overlap.
+class region_label_map{
+public:
+    std::vector<int> label;
+    std::vector<std::vector<short> > overlap;
+private:
+    // region r owns voxel_list[voxel_pos[r]] to voxel_list[voxel_pos[r+1]-1]
+    std::vector<size_t> voxel_pos;
+    std::vector<unsigned int> voxel_list;
+public:
+    void clear(void)
+    {
+        label.clear();
+        overlap.clear();
+        voxel_pos.clear();
+        voxel_list.clear();
+    }
+    // builds the region-to-voxel lists in two passes, so that for_each_voxel
+    // no longer scans the whole volume for each region
+    void build_voxel_index(void)
+    {
+        size_t region_count = 0;
+        for(int l : label)
+            if(l >= 0)
+                region_count = std::max<size_t>(region_count,size_t(l)+1);
+        for(const auto& list : overlap)
+            if(!list.empty())
+                region_count = std::max<size_t>(region_count,size_t(list.back()+1));
+        voxel_pos.clear();
+        voxel_pos.resize(region_count+1);
+        for(unsigned int index = 0;index < label.size();++index)
+            for_each_region(index,[&](short r){++voxel_pos[size_t(r)+1];});
+        for(size_t r = 1;r < voxel_pos.size();++r)
+            voxel_pos[r] += voxel_pos[r-1];
+        voxel_list.resize(voxel_pos.back());
+        std::vector<size_t> pos(voxel_pos.begin(),voxel_pos.end()-1);
+        for(unsigned int index = 0;index < label.size();++index)
+            for_each_region(index,[&](short r){voxel_list[pos[size_t(r)]++] = index;});
+    }
+    template<class fun_type>
+    void for_each_region(unsigned int index,fun_type&& fun) const
+    {
+        int l = label[index];
+        if(l >= 0)
+            fun(short(l));
+        else
+        if(l < -1)
+            for(short r : overlap[size_t(-2-l)])
+                fun(r);
+    }
+    void get_regions(unsigned int index,std::vector<short>& regions) const
+    {
+        regions.clear();
+        for_each_region(index,[&](short r){regions.push_back(r);});
+    }
+    // calls fun(index) for every voxel in region, in ascending order
+    template<class fun_type>
+    void for_each_voxel(short region,fun_type&& fun) const
+    {
+        if(!voxel_pos.empty())
+        {
+            if(region < 0 || size_t(region)+1 >= voxel_pos.size())
+                return;
+            for(size_t i = voxel_pos[size_t(region)];i < voxel_pos[size_t(region)+1];++i)
+                fun(voxel_list[i]);
+            return;
+        }
+        std::vector<char> in_overlap(overlap.size());
+        for(size_t k = 0;k < overlap.size();++k)
+            in_overlap[k] = std::binary_search(overlap[k].begin(),overlap[k].end(),region);
+        for(unsigned int index = 0;index < label.size();++index)
+        {
+            int l = label[index];
+            if(l == region || (l < -1 && in_overlap[size_t(-2-l)]))
+                fun(index);
+        }
+    }
+};
 class atlas{
 private:
     tipl::image<int,3> I;
@@ -11,7 +91,7 @@ private:
     tipl::matrix<4,4,float> T;
     void load_label(void);
     int get_index(tipl::vector<3,float> atlas_space);
-private:// for talairach only
+private:// label value to label indices (talairach may have several per value)
     std::vector<std::vector<unsigned int> > index2label;
     std::vector<std::vector<unsigned int> > label2index;
 private:// for track atlas only
@@ -44,6 +124,10 @@ public:
     }
     //std::string get_label_name_at(const tipl::vector<3,float>& mni_space);
     bool is_labeled_as(const tipl::vector<3,float>& mni_space,unsigned int label);
+    // all label indices at mni_space in ascending order. load_from_file must have been called
+    void get_labels(const tipl::vector<3,float>& mni_space,std::vector<unsigned int>& result);
+    // labels of all voxels in one parallel pass over their mni positions
+    bool get_label_map(const tipl::image<tipl::vector<3,float>,3>& mni_position,region_label_map& result);
     int get_track_label(const std::vector<tipl::vector<3> >& points);
 };
 
@@ -1,36 +1,23 @@
 #include "connectometry_db.hpp"
 #include "fib_data.hpp"
+#include "utility/memory_info.hpp"
 
 void connectometry_db::read_db(fib_data* handle_)
 {
     handle = handle_;
     subject_qa.clear();
     subject_qa_sd.clear();
+    // count the subject matrices from the table of contents,
+    // the data are loaded by load_subject_qa when first needed
     unsigned int row,col;
-    for(unsigned int index = 0;1;++index)
+    for(num_subjects = 0;1;++num_subjects)
     {
         std::ostringstream out;
-        out << "subject" << index;
-        const float* buf = 0;
-        handle->mat_reader.read(out.str().c_str(),row,col,buf);
-        if (!buf)
+        out << "subject" << num_subjects;
+        if(!handle->mat_reader.get_size(out.str().c_str(),row,col))
             break;
-        if(!index)
-            subject_qa_length = row*col;
-        subject_qa.push_back(buf);
-        subject_qa_sd.push_back(0);
     }
-
-    tipl::par_for(subject_qa.size(),[&](int i){
-        subject_qa_sd[i] = tipl::standard_deviation(subject_qa[i],subject_qa[i]+subject_qa_length);
-        if(subject_qa_sd[i] == 0.0)
-            subject_qa_sd[i] = 1.0;
-        else
-            subject_qa_sd[i] = 1.0/subject_qa_sd[i];
-
-    });
-
-    num_subjects = (unsigned int)subject_qa.size();
+    subject_qa_on_disk = num_subjects > 0;
     subject_names.resize(num_subjects);
     R2.resize(num_subjects);
     if(!num_subjects)
@@ -61,7 +48,7 @@ void connectometry_db::read_db(fib_data* handle_)
         {
             handle->error_msg = "Memory insufficiency. Use 64-bit program instead";
             num_subjects = 0;
-            subject_qa.clear();
+            subject_qa_on_disk = false;
             return;
         }
         std::copy(r2_values,r2_values+num_subjects,R2.begin());
@@ -70,6 +57,89 @@ void connectometry_db::read_db(fib_data* handle_)
     calculate_si2vi();
 }
 
+bool connectometry_db::load_subject_qa(void)
+{
+    if(!subject_qa_on_disk)
+        return true;
+    subject_qa_on_disk = false;
+    unsigned int row,col;
+    for(unsigned int index = 0;index < num_subjects;++index)
+    {
+        std::ostringstream out;
+        out << "subject" << index;
+        const float* buf = 0;
+        handle->mat_reader.read(out.str().c_str(),row,col,buf);
+        if (!buf)
+        {
+            handle->error_msg = "Cannot read subject data. The file may be corrupted";
+            subject_qa.clear();
+            subject_qa_sd.clear();
+            num_subjects = 0;
+            check_prog(0,0);
+            return false;
+        }
+        subject_qa.push_back(buf);
+        subject_qa_sd.push_back(0);
+    }
+    check_prog(0,0);
+    tipl::par_for(subject_qa.size(),[&](int i){
+        subject_qa_sd[i] = tipl::standard_deviation(subject_qa[i],subject_qa[i]+subject_qa_length);
+        if(subject_qa_sd[i] == 0.0)
+            subject_qa_sd[i] = 1.0;
+        else
+            subject_qa_sd[i] = 1.0/subject_qa_sd[i];
+
+    });
+    return true;
+}
+
+bool connectometry_db::build_voxel_major(void)
+{
+    if(!voxel_major_qa.empty())
+        return true;
+    if(!load_subject_qa() || !num_subjects)
+        return false;
+    // check up front: with overcommit the allocation below succeeds and the system swaps instead
+    size_t available = get_available_memory();
+    size_t needed = size_t(subject_qa_length)*num_subjects*sizeof(float);
+    if(!available || needed > available/2)
+    {
+        if(!available)
+            std::cout << "cannot determine the available memory, voxel-major copy skipped" << std::endl;
+        else
+            std::cout << "voxel-major copy needs " << (needed >> 20) << " MB but only "
+                      << (available >> 20) << " MB is available, copy skipped" << std::endl;
+        return false;
+    }
+    try{
+        voxel_major_qa.resize(size_t(subject_qa_length)*num_subjects);
+    }
+    catch(...)
+    {
+        // not enough memory: calculate_spm reads the subject-major data instead
+        clear_voxel_major();
+        return false;
+    }
+    // transpose in tiles so that both sides stay in cache
+    const unsigned int tile = 256;
+    tipl::par_for((subject_qa_length+tile-1)/tile,[&](unsigned int t)
+    {
+        unsigned int from = t*tile;
+        unsigned int to = std::min<unsigned int>(from+tile,subject_qa_length);
+        for(unsigned int s = 0;s < num_subjects;s += 16)
+        {
+            unsigned int s_end = std::min<unsigned int>(s+16,num_subjects);
+            for(unsigned int pos = from;pos < to;++pos)
+            {
+                float* out = &voxel_major_qa[size_t(pos)*num_subjects];
+                for(unsigned int i = s;i < s_end;++i)
+                    out[i] = subject_qa[i][pos];
+            }
+        }
+    });
+    return true;
+}
+
 
 bool connectometry_db::parse_demo(const std::string& filename,float missing_value)
 {
@@ -190,6 +260,8 @@ bool connectometry_db::parse_demo(const std::string& filename,float missing_valu
 
 void connectometry_db::remove_subject(unsigned int index)
 {
+    load_subject_qa();
+    clear_voxel_major();
     if(index >= subject_qa.size())
         return;
     subject_qa.erase(subject_qa.begin()+index);
@@ -212,7 +284,7 @@ void connectometry_db::calculate_si2vi(void)
     }
     subject_qa_length = handle->dir.num_fiber*si2vi.size();
 }
-bool connectometry_db::sample_odf(gz_mat_read& m,std::vector<float>& data)
+bool connectometry_db::sample_odf(gz_mat_lazy_read& m,std::vector<float>& data)
 {
     odf_data subject_odf;
     if(!subject_odf.read(m))
@@ -236,7 +308,7 @@ bool connectometry_db::sample_odf(gz_mat_read& m,std::vector<float>& data)
     }
     return true;
 }
-bool connectometry_db::sample_index(gz_mat_read& m,std::vector<float>& data,const char* index_name)
+bool connectometry_db::sample_index(gz_mat_lazy_read& m,std::vector<float>& data,const char* index_name)
 {
     const float* index_of_interest = 0;
     unsigned int row,col;
@@ -255,7 +327,7 @@ bool connectometry_db::sample_index(gz_mat_read& m,std::vector<float>& data,cons
     }
     return true;
 }
-bool connectometry_db::is_consistent(gz_mat_read& m)
+bool connectometry_db::is_consistent(gz_mat_lazy_read& m)
 {
     unsigned int row,col;
     const float* odf_buffer = 0;
@@ -299,7 +371,10 @@ bool connectometry_db::is_consistent(gz_mat_read& m)
 bool connectometry_db::add_subject_file(const std::string& file_name,
                                          const std::string& subject_name)
 {
-    gz_mat_read m;
+    if(!load_subject_qa())
+        return false;
+    clear_voxel_major();
+    gz_mat_lazy_read m;
     if(!m.load_from_file(file_name.c_str()))
     {
         handle->error_msg = "failed to load subject data ";
@@ -548,6 +623,8 @@ void connectometry_db::save_subject_vector(const char* output_name,
 }
 bool connectometry_db::save_subject_data(const char* output_name)
 {
+    if(!load_subject_qa())
+        return false;
     // store results
     gz_mat_write matfile(output_name);
     if(!matfile)
@@ -556,9 +633,9 @@ bool connectometry_db::save_subject_data(const char* output_name)
         return false;
     }
     for(unsigned int index = 0;index < handle->mat_reader.size();++index)
-        if(handle->mat_reader[index].get_name() != "report" &&
-           handle->mat_reader[index].get_name().find("subject") != 0)
-            matfile.write(handle->mat_reader[index]);
+        if(handle->mat_reader.name(index) != "report" &&
+           handle->mat_reader.name(index).find("subject") != 0)
+            handle->mat_reader.write_to(matfile,index);
     for(unsigned int index = 0;check_prog(index,(unsigned int)subject_qa.size());++index)
     {
         std::ostringstream out;
@@ -613,6 +690,51 @@ void connectometry_db::get_subject_fa(unsigned int subject_index,std::vector<std
         }
     }
 }
+void connectometry_db::get_region_stat(const std::vector<std::vector<tipl::vector<3> > >& regions,std::vector<std::vector<float> >& result) const
+{
+    // interpolation weights of each point on the database voxels, shared by all subjects
+    std::vector<std::vector<unsigned int> > point_begin(regions.size());
+    std::vector<std::vector<std::pair<unsigned int,float> > > samples(regions.size());
+    tipl::par_for(regions.size(),[&](unsigned int r)
+    {
+        point_begin[r].push_back(0);
+        for(const auto& p : regions[r])
+        {
+            tipl::interpolation<tipl::linear_weighting,3> interpo;
+            if(interpo.get_location(handle->dim,p))
+                for(unsigned int i = 0;i < 8;++i)
+                    if(interpo.ratio[i] != 0.0f && handle->dir.fa[0][interpo.dindex[i]] > 0.0f)
+                        samples[r].push_back(std::make_pair(vi2si[interpo.dindex[i]],float(interpo.ratio[i])));
+            point_begin[r].push_back(uint32_t(samples[r].size()));
+        }
+    });
+    result.clear();
+    result.resize(regions.size(),std::vector<float>(size_t(num_subjects)*2));
+    tipl::par_for(num_subjects,[&](unsigned int subject_index)
+    {
+        const float* qa = subject_qa[subject_index];
+        for(size_t r = 0;r < regions.size();++r)
+        {
+            float sum = 0.0f,sum2 = 0.0f;
+            unsigned int count = 0;
+            for(size_t i = 0;i+1 < point_begin[r].size();++i)
+            {
+                float value = 0.0f;
+                for(unsigned int j = point_begin[r][i];j < point_begin[r][i+1];++j)
+                    value += samples[r][j].second*qa[samples[r][j].first];
+                if(value == 0.0f)
+                    continue;
+                sum += value;
+                sum2 += value*value;
+                ++count;
+            }
+            sum /= count;
+            sum2 /= count;
+            result[r][subject_index*2] = sum;
+            result[r][subject_index*2+1] = std::sqrt(std::max<float>(0.0f,sum2-sum*sum));
+        }
+    });
+}
 void connectometry_db::get_data_at(unsigned int index,unsigned int fib_index,std::vector<double>& data,bool normalize_qa) const
 {
     data.clear();
@@ -630,7 +752,7 @@ void connectometry_db::get_data_at(unsigned int index,unsigned int fib_index,std
 }
 bool connectometry_db::get_odf_profile(const char* file_name,std::vector<float>& cur_subject_data)
 {
-    gz_mat_read single_subject;
+    gz_mat_lazy_read single_subject;
     if(!single_subject.load_from_file(file_name))
     {
         handle->error_msg = "fail to load the fib file";
@@ -653,7 +775,7 @@ bool connectometry_db::get_odf_profile(const char* file_name,std::vector<float>&
 }
 bool connectometry_db::get_qa_profile(const char* file_name,std::vector<std::vector<float> >& data)
 {
-    gz_mat_read single_subject;
+    gz_mat_lazy_read single_subject;
     if(!single_subject.load_from_file(file_name))
     {
         handle->error_msg = "fail to load the fib file";
@@ -719,6 +841,8 @@ void connectometry_db::read_subject_qa(std::vector<std::vector<float> >&data) co
 
 bool connectometry_db::add_db(const connectometry_db& rhs)
 {
+    load_subject_qa();
+    clear_voxel_major();
     if(!is_db_compatible(rhs))
         return false;
     R2.insert(R2.end(),rhs.R2.begin(),rhs.R2.end());
@@ -738,6 +862,8 @@ bool connectometry_db::add_db(const connectometry_db& rhs)
 }
 void connectometry_db::move_up(int id)
 {
+    load_subject_qa();
+    clear_voxel_major();
     if(id == 0)
         return;
     std::swap(subject_names[id],subject_names[id-1]);
@@ -748,6 +874,8 @@ void connectometry_db::move_up(int id)
 
 void connectometry_db::move_down(int id)
 {
+    load_subject_qa();
+    clear_voxel_major();
     if(id >= num_subjects-1)
         return;
     std::swap(subject_names[id],subject_names[id+1]);
@@ -790,6 +918,8 @@ void connectometry_db::auto_match(const tipl::image<int,3>& fp_mask,float fiber_
 }
 void connectometry_db::calculate_change(unsigned char dif_type,bool norm)
 {
+    load_subject_qa();
+    clear_voxel_major();
     std::ostringstream out;
 
 
@@ -873,36 +1003,114 @@ void connectometry_db::calculate_change(unsigned char dif_type,bool norm)
 
 }
 
-void calculate_spm(std::shared_ptr<fib_data> handle,connectometry_result& data,stat_model& info,
-                   float fiber_threshold,bool normalize_qa,bool& terminated)
+void calculate_spm(std::shared_ptr<fib_data> handle,const std::vector<stat_model*>& info,
+                   std::vector<std::vector<float> >& spm,
+                   float fiber_threshold,bool normalize_qa,bool& terminated,unsigned int thread_count)
 {
-    data.initialize(handle);
-    std::vector<double> population(handle->db.subject_qa.size());
-    for(unsigned int s_index = 0;s_index < handle->db.si2vi.size() && !terminated;++s_index)
+    const connectometry_db& db = handle->db;
+    unsigned int subject_count = db.subject_qa.size();
+    spm.resize(info.size());
+    for(unsigned int k = 0;k < info.size();++k)
     {
-        unsigned int cur_index = handle->db.si2vi[s_index];
-        for(unsigned int fib = 0,fib_offset = 0;fib < handle->dir.num_fiber && handle->dir.fa[fib][cur_index] > fiber_threshold;
-                ++fib,fib_offset+=handle->db.si2vi.size())
+        spm[k].clear();
+        spm[k].resize(db.subject_qa_length);
+    }
+    if(!subject_count || info.empty())
+        return;
+    std::vector<char> block_regression(info.size());
+    for(unsigned int k = 0;k < info.size();++k)
+        block_regression[k] = info[k]->prepare_block_regression(subject_count);
+    bool voxel_major = db.voxel_major_qa.size() == size_t(db.subject_qa_length)*subject_count;
+    thread_count = std::max<unsigned int>(1,thread_count);
+    const unsigned int block_size = 64;
+    unsigned int block_count = (db.si2vi.size()+block_size-1)/block_size;
+    std::vector<std::vector<unsigned int> > pos_buf(thread_count);
+    std::vector<std::vector<double> > population_buf(thread_count),result_buf(thread_count);
+    tipl::par_for2(block_count,[&](unsigned int block,unsigned int id)
+    {
+        if(terminated)
+            return;
+        std::vector<unsigned int>& pos = pos_buf[id];
+        std::vector<double>& population = population_buf[id];
+        std::vector<double>& result = result_buf[id];
+        pos.clear();
+        unsigned int s_end = std::min<unsigned int>((block+1)*block_size,db.si2vi.size());
+        for(unsigned int s_index = block*block_size;s_index < s_end;++s_index)
         {
-            unsigned int pos = s_index + fib_offset;
+            unsigned int cur_index = db.si2vi[s_index];
+            for(unsigned int fib = 0,fib_offset = 0;fib < handle->dir.num_fiber && handle->dir.fa[fib][cur_index] > fiber_threshold;
+                    ++fib,fib_offset+=db.si2vi.size())
+                pos.push_back(s_index + fib_offset);
+        }
+        // gather the block once for all models, one row of subjects per fiber
+        population.resize(pos.size()*subject_count);
+        if(voxel_major)
+        {
+            for(unsigned int j = 0;j < pos.size();++j)
+            {
+                const float* qa = &db.voxel_major_qa[size_t(pos[j])*subject_count];
+                double* out = &population[j*subject_count];
+                if(normalize_qa)
+                    for(unsigned int index = 0;index < subject_count;++index)
+                        out[index] = qa[index]*db.subject_qa_sd[index];
+                else
+                    std::copy(qa,qa+subject_count,out);
+            }
+        }
+        else
+        for(unsigned int index = 0;index < subject_count;++index)
+        {
+            const float* qa = db.subject_qa[index];
             if(normalize_qa)
-                for(unsigned int index = 0;index < population.size();++index)
-                    population[index] = handle->db.subject_qa[index][pos]*handle->db.subject_qa_sd[index];
+                for(unsigned int j = 0;j < pos.size();++j)
+                    population[j*subject_count+index] = qa[pos[j]]*db.subject_qa_sd[index];
             else
-                for(unsigned int index = 0;index < population.size();++index)
-                    population[index] = handle->db.subject_qa[index][pos];
-
-            if(std::find(population.begin(),population.end(),0.0) != population.end())
+                for(unsigned int j = 0;j < pos.size();++j)
+                    population[j*subject_count+index] = qa[pos[j]];
+        }
+        // skip fibers missing in any subject
+        unsigned int count = 0;
+        for(unsigned int j = 0;j < pos.size();++j)
+        {
+            double* row = &population[j*subject_count];
+            if(std::find(row,row+subject_count,0.0) != row+subject_count)
                 continue;
-            double result = info(population,pos);
-
-            if(result > 0.0) // group 0 > group 1
-                data.greater[fib][cur_index] = result;
-            if(result < 0.0) // group 0 < group 1
-                data.lesser[fib][cur_index] = -result;
-
+            if(count != j)
+            {
+                std::copy(row,row+subject_count,&population[count*subject_count]);
+                pos[count] = pos[j];
+            }
+            ++count;
         }
-    }
+        if(!count)
+            return;
+        result.resize(count);
+        std::vector<double> one;
+        for(unsigned int k = 0;k < info.size();++k)
+        {
+            if(block_regression[k])
+                info[k]->regress_block(&population[0],count,&result[0]);
+            else
+            {
+                one.resize(subject_count);
+                for(unsigned int j = 0;j < count;++j)
+                {
+                    std::copy(&population[j*subject_count],&population[j*subject_count]+subject_count,one.begin());
+                    result[j] = (*info[k])(one,pos[j]);
+                }
+            }
+            for(unsigned int j = 0;j < count;++j)
+                spm[k][pos[j]] = result[j];
+        }
+    },thread_count);
+}
+
+void calculate_spm(std::shared_ptr<fib_data> handle,connectometry_result& data,stat_model& info,
+                   float fiber_threshold,bool normalize_qa,bool& terminated,unsigned int thread_count)
+{
+    std::vector<std::vector<float> > spm;
+    calculate_spm(handle,std::vector<stat_model*>(1,&info),spm,fiber_threshold,normalize_qa,terminated,thread_count);
+    data.set_spm(handle,spm[0],true,true);
 }
 
 
@@ -929,6 +1137,24 @@ void connectometry_result::initialize(std::shared_ptr<fib_data> handle)
         std::fill(lesser[fib].begin(),lesser[fib].end(),0.0);
     }
 }
+void connectometry_result::set_spm(std::shared_ptr<fib_data> handle,const std::vector<float>& spm,
+                                   bool set_greater,bool set_lesser)
+{
+    initialize(handle);
+    const std::vector<unsigned int>& si2vi = handle->db.si2vi;
+    for(unsigned int pos = 0;pos < spm.size();++pos)
+    {
+        float result = spm[pos];
+        if(result == 0.0f)
+            continue;
+        unsigned int fib = pos/si2vi.size();
+        unsigned int cur_index = si2vi[pos-fib*si2vi.size()];
+        if(result > 0.0f && set_greater) // group 0 > group 1
+            greater[fib][cur_index] = result;
+        if(result < 0.0f && set_lesser) // group 0 < group 1
+            lesser[fib][cur_index] = -result;
+    }
+}
 void connectometry_result::remove_old_index(std::shared_ptr<fib_data> handle)
 {
     for(unsigned int index = 0;index < handle->dir.index_name.size();++index)
@@ -960,6 +1186,11 @@ bool connectometry_result::individual_vs_db(std::shared_ptr<fib_data> handle,con
         error_msg = "Please open a connectometry database first.";
         return false;
     }
+    if(!handle->db.load_subject_qa())
+    {
+        error_msg = handle->error_msg;
+        return false;
+    }
     handle->dir.set_tracking_index(0);
     std::vector<float> data;
     if(!handle->db.get_odf_profile(file_name,data))
@@ -1130,6 +1361,133 @@ void stat_model::select_variables(const std::vector<char>& sel)
     X.swap(new_X);
 }
 
+bool stat_model::prepare_block_regression(unsigned int db_subject_count)
+{
+    block_pinv.clear();
+    unsigned int n = subject_index.size();
+    unsigned int p = feature_count;
+    if(type != 1 || !n || n <= p || X.size() != size_t(n)*p ||
+       (threshold_type != t && threshold_type != beta && threshold_type != percentage))
+        return false;
+    for(unsigned int k = 0;k < n;++k)
+        if(subject_index[k] >= db_subject_count)
+            return false;
+    block_XtX.clear();
+    block_XtX.resize(p*p);
+    for(unsigned int k = 0;k < n;++k)
+        for(unsigned int i = 0;i < p;++i)
+            for(unsigned int j = 0;j < p;++j)
+                block_XtX[i*p+j] += X[k*p+i]*X[k*p+j];
+    // Gauss-Jordan elimination for the inverse of X'X
+    std::vector<double> A(block_XtX),inv(p*p);
+    for(unsigned int i = 0;i < p;++i)
+        inv[i*p+i] = 1.0;
+    for(unsigned int c = 0;c < p;++c)
+    {
+        unsigned int pivot = c;
+        for(unsigned int r = c+1;r < p;++r)
+            if(std::fabs(A[r*p+c]) > std::fabs(A[pivot*p+c]))
+                pivot = r;
+        if(A[pivot*p+c] == 0.0)
+            return false;
+        if(pivot != c)
+            for(unsigned int j = 0;j < p;++j)
+            {
+                std::swap(A[c*p+j],A[pivot*p+j]);
+                std::swap(inv[c*p+j],inv[pivot*p+j]);
+            }
+        double scale = 1.0/A[c*p+c];
+        for(unsigned int j = 0;j < p;++j)
+        {
+            A[c*p+j] *= scale;
+            inv[c*p+j] *= scale;
+        }
+        for(unsigned int r = 0;r < p;++r)
+            if(r != c && A[r*p+c] != 0.0)
+            {
+                double f = A[r*p+c];
+                for(unsigned int j = 0;j < p;++j)
+                {
+                    A[r*p+j] -= f*A[c*p+j];
+                    inv[r*p+j] -= f*inv[c*p+j];
+                }
+            }
+    }
+    block_cov.resize(p);
+    for(unsigned int i = 0;i < p;++i)
+        block_cov[i] = inv[i*p+i];
+    // (X'X)^-1 X' with the resampled subjects folded back to the database order,
+    // so that a block of voxels is regressed by one matrix product
+    block_weight.clear();
+    block_weight.resize(db_subject_count);
+    std::vector<double> pinv(size_t(p)*db_subject_count);
+    for(unsigned int k = 0;k < n;++k)
+    {
+        unsigned int s = subject_index[k];
+        block_weight[s] += 1.0;
+        for(unsigned int i = 0;i < p;++i)
+        {
+            double sum = 0.0;
+            for(unsigned int j = 0;j < p;++j)
+                sum += inv[i*p+j]*X[k*p+j];
+            pinv[size_t(i)*db_subject_count+s] += sum;
+        }
+    }
+    block_pinv.swap(pinv);
+    return true;
+}
+
+void stat_model::regress_block(const double* population,unsigned int count,double* result) const
+{
+    unsigned int m = block_weight.size();
+    unsigned int n = subject_index.size();
+    unsigned int p = feature_count;
+    std::vector<double> b(p);
+    for(unsigned int r = 0;r < count;++r,population += m)
+    {
+        for(unsigned int i = 0;i < p;++i)
+        {
+            const double* P = &block_pinv[size_t(i)*m];
+            double sum = 0.0;
+            for(unsigned int s = 0;s < m;++s)
+                sum += P[s]*population[s];
+            b[i] = sum;
+        }
+        switch(threshold_type)
+        {
+        case beta:
+            result[r] = b[study_feature];
+            break;
+        case percentage:
+            {
+                double mean = 0.0;
+                for(unsigned int s = 0;s < m;++s)
+                    mean += block_weight[s]*population[s];
+                mean /= double(n);
+                result[r] = mean == 0 ? 0:b[study_feature]*X_range[study_feature]/mean;
+            }
+            break;
+        default: // t
+            {
+                // residual sum of squares = y'y - b'X'Xb
+                double rss = 0.0;
+                for(unsigned int s = 0;s < m;++s)
+                    rss += block_weight[s]*population[s]*population[s];
+                for(unsigned int i = 0;i < p;++i)
+                {
+                    double sum = 0.0;
+                    for(unsigned int j = 0;j < p;++j)
+                        sum += block_XtX[i*p+j]*b[j];
+                    rss -= b[i]*sum;
+                }
+                double rmse = std::sqrt(std::max<double>(0.0,rss)/double(n-p));
+                result[r] = b[study_feature]/std::sqrt(block_cov[study_feature])/rmse;
+            }
+            break;
+        }
+    }
+}
+
 bool stat_model::pre_process(void)
 {
     switch(type)
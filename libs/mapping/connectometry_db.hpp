@@ -2,6 +2,7 @@
 #define CONNECTOMETRY_DB_H
 #include <vector>
 #include <string>
+#include <thread>
 #include "gzip_interface.hpp"
 #include "tipl/tipl.hpp"
 class fib_data;
@@ -26,12 +27,17 @@ public:// subject specific data
     std::vector<float> R2;
     std::vector<const float*> subject_qa;
     std::vector<float> subject_qa_sd;
+    bool subject_qa_on_disk = false; // subject data not yet loaded by load_subject_qa
 public:
     std::list<std::vector<float> > subject_qa_buf;// merged from other db
     unsigned int subject_qa_length;
     tipl::image<unsigned int,3> vi2si;
     std::vector<unsigned int> si2vi;
     std::string index_name;
+public:// optional voxel-major copy, voxel_major_qa[pos*num_subjects+subject]
+    std::vector<float> voxel_major_qa;
+    bool build_voxel_major(void);
+    void clear_voxel_major(void){std::vector<float>().swap(voxel_major_qa);}
 public://longitudinal studies
     std::vector<std::pair<int,int> > match;
     void auto_match(const tipl::image<int,3>& fp_mask,float fiber_threshold,bool normalize_fp);
@@ -40,11 +46,12 @@ public:
     connectometry_db():num_subjects(0),modified(false){;}
     bool has_db(void)const{return num_subjects > 0;}
     void read_db(fib_data* handle);
+    bool load_subject_qa(void);
     void remove_subject(unsigned int index);
     void calculate_si2vi(void);
-    bool sample_odf(gz_mat_read& m,std::vector<float>& data);
-    bool sample_index(gz_mat_read& m,std::vector<float>& data,const char* index_name);
-    bool is_consistent(gz_mat_read& m);
+    bool sample_odf(gz_mat_lazy_read& m,std::vector<float>& data);
+    bool sample_index(gz_mat_lazy_read& m,std::vector<float>& data,const char* index_name);
+    bool is_consistent(gz_mat_lazy_read& m);
     bool add_subject_file(const std::string& file_name,
                             const std::string& subject_name);
     void get_subject_vector_pos(std::vector<int>& subject_vector_pos,
@@ -65,6 +72,9 @@ public:
     void get_subject_slice(unsigned int subject_index,unsigned char dim,unsigned int pos,
                             tipl::image<float,2>& slice) const;
     void get_subject_fa(unsigned int subject_index,std::vector<std::vector<float> >& fa_data) const;
+    // mean and sd of every subject's first-fiber values over each region (points in voxel coordinates),
+    // sampled in si2vi space the way tipl::estimate samples get_subject_fa. result[region] = {mean,sd,mean,sd,...}
+    void get_region_stat(const std::vector<std::vector<tipl::vector<3> > >& regions,std::vector<std::vector<float> >& result) const;
     void get_data_at(unsigned int index,unsigned int fib_index,std::vector<double>& data,bool normalize_qa) const;
     bool get_odf_profile(const char* file_name,std::vector<float>& cur_subject_data);
     bool get_qa_profile(const char* file_name,std::vector<std::vector<float> >& data);
@@ -97,6 +107,10 @@ public: // multiple regression
     enum {percentage = 0,t = 1,beta = 2,percentile = 3,mean_dif = 4} threshold_type;
     tipl::multiple_regression<double> mr;
     void select_variables(const std::vector<char>& sel);
+public: // multiple regression solved for a block of voxels at once
+    std::vector<double> block_pinv,block_XtX,block_cov,block_weight;
+    bool prepare_block_regression(unsigned int db_subject_count);
+    void regress_block(const double* population,unsigned int count,double* result) const;
 public: // individual
     const float* individual_data;
     float individual_data_sd;
@@ -147,6 +161,7 @@ public:
     std::string report;
     std::string error_msg;
     void initialize(std::shared_ptr<fib_data> fib_file);
+    void set_spm(std::shared_ptr<fib_data> handle,const std::vector<float>& spm,bool set_greater,bool set_lesser);
     void add_mapping_for_tracking(std::shared_ptr<fib_data> handle,const char* t1,const char* t2);
     bool individual_vs_atlas(std::shared_ptr<fib_data> handle,const char* file_name,unsigned char normalization);
     bool individual_vs_db(std::shared_ptr<fib_data> handle,const char* file_name);
@@ -155,8 +170,14 @@ public:
 
 };
 
+// one pass over the subject data for all models, spm[model][pos] in the subject data layout
+void calculate_spm(std::shared_ptr<fib_data> handle,const std::vector<stat_model*>& info,
+                   std::vector<std::vector<float> >& spm,
+                   float fiber_threshold,bool normalize_qa,bool& terminated,
+                   unsigned int thread_count = std::thread::hardware_concurrency());
 void calculate_spm(std::shared_ptr<fib_data> handle,connectometry_result& data,stat_model& info,
-                   float fiber_threshold,bool normalize_qa,bool& terminated);
+                   float fiber_threshold,bool normalize_qa,bool& terminated,
+                   unsigned int thread_count = std::thread::hardware_concurrency());
 
 
 #endif // CONNECTOMETRY_DB_H
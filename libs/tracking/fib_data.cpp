@@ -3,31 +3,74 @@
 #include "fib_data.hpp"
 #include "tessellated_icosahedron.hpp"
 extern std::vector<std::string> fa_template_list;
-bool odf_data::read(gz_mat_read& mat_reader)
+template<class value_type>
+bool decode_odf_block(gz_mat_lazy_read& mat_reader,const std::string& name,std::vector<float>& odf)
+{
+    unsigned int row,col,range_row,range_col;
+    const value_type* q = nullptr;
+    const float* range = nullptr;
+    if(!mat_reader.read(name.c_str(),row,col,q) ||
+       !mat_reader.read((name+"_range").c_str(),range_row,range_col,range))
+        return false;
+    size_t voxel_count = size_t(range_row)*size_t(range_col)/2;
+    if(!voxel_count || !q || size_t(row)*size_t(col) % voxel_count)
+        return false;
+    size_t odf_size = size_t(row)*size_t(col)/voxel_count;
+    odf.resize(size_t(row)*size_t(col));
+    tipl::par_for(voxel_count,[&](size_t i)
+    {
+        float offset = range[i*2];
+        float step = range[i*2+1];
+        const value_type* from = q + i*odf_size;
+        float* to = &odf[0] + i*odf_size;
+        for(size_t j = 0;j < odf_size;++j)
+            to[j] = offset + float(from[j])*step;
+    });
+    return true;
+}
+bool read_odf_blocks(gz_mat_lazy_read& mat_reader,
+                     std::vector<const float*>& blocks,
+                     std::vector<unsigned int>& block_size,
+                     std::vector<std::vector<float> >& decoded_buf)
+{
+    blocks.clear();
+    block_size.clear();
+    decoded_buf.clear();
+    for(unsigned int index = 0;1;++index)
+    {
+        unsigned int row,col;
+        const float* odf = 0;
+        std::ostringstream out;
+        out << "odf" << index;
+        if(mat_reader.read(out.str().c_str(),row,col,odf))
+        {
+            blocks.push_back(odf);
+            block_size.push_back(row*col);
+            continue;
+        }
+        std::ostringstream qout;
+        qout << "odfq" << index;
+        std::string name = qout.str();
+        if(!mat_reader.has(name.c_str()))
+            break;
+        decoded_buf.push_back(std::vector<float>());
+        if(!(mat_reader.stored_as<unsigned char>(name.c_str()) ?
+                decode_odf_block<unsigned char>(mat_reader,name,decoded_buf.back()) :
+                decode_odf_block<unsigned short>(mat_reader,name,decoded_buf.back())))
+            break;
+        blocks.push_back(&decoded_buf.back()[0]);
+        block_size.push_back(uint32_t(decoded_buf.back().size()));
+    }
+    return !blocks.empty();
+}
+bool odf_data::read(gz_mat_lazy_read& mat_reader)
 {
     unsigned int row,col;
     {
         if(mat_reader.read("odfs",row,col,odfs))
             odfs_size = row*col;
         else
-        {
-            for(unsigned int index = 0;1;++index)
-            {
-                const float* odf = 0;
-                std::ostringstream out;
-                out << "odf" << index;
-                std::string name = out.str();
-                if(!mat_reader.read(name.c_str(),row,col,odf))
-                    break;
-                if(odf_blocks.size() <= index)
-                {
-                    odf_blocks.resize(index+1);
-                    odf_block_size.resize(index+1);
-                }
-                odf_blocks[index] = odf;
-                odf_block_size[index] = row*col;
-            }
-        }
+            read_odf_blocks(mat_reader,odf_blocks,odf_block_size,odf_block_buf);
     }
     if(!has_odfs())
         return false;
@@ -140,7 +183,7 @@ void fiber_directions::check_index(unsigned int index)
     }
 }
 
-bool fiber_directions::add_data(gz_mat_read& mat_reader)
+bool fiber_directions::add_data(gz_mat_lazy_read& mat_reader)
 {
     unsigned int row,col;
 
@@ -180,6 +223,8 @@ bool fiber_directions::add_data(gz_mat_read& mat_reader)
         }
     }
 
+    // matrix indices of the other indices, read after the integrity check
+    std::vector<std::vector<unsigned int> > index_matrix(index_name.size());
     for (unsigned int index = 0;index < mat_reader.size();++index)
     {
         std::string matrix_name = mat_reader.name(index);
@@ -232,12 +277,41 @@ bool fiber_directions::add_data(gz_mat_read& mat_reader)
         {
             index_name.push_back(prefix_name);
             index_data.push_back(std::vector<const float*>());
+            index_matrix.push_back(std::vector<unsigned int>());
         }
 
         if(index_data[prefix_name_index].size() <= store_index)
+        {
             index_data[prefix_name_index].resize(store_index+1);
-        mat_reader.read(index,row,col,index_data[prefix_name_index][store_index]);
+            index_matrix[prefix_name_index].resize(store_index+1,mat_reader.size());
+        }
+        index_matrix[prefix_name_index][store_index] = index;
+    }
 
+    // only indices with one volume per fiber are loaded, leaving
+    // ODF blocks and subject data on disk until they are needed
+    {
+        unsigned int fa_row = 0,fa_col = 0;
+        if(!mat_reader.get_size("fa0",fa_row,fa_col))
+            mat_reader.get_size("image",fa_row,fa_col);
+        for(int i = 0;i < index_matrix.size();++i)
+        {
+            bool is_volume = index_matrix[i].size() == num_fiber;
+            for(unsigned int j = 0;is_volume && j < index_matrix[i].size();++j)
+                is_volume = index_matrix[i][j] < mat_reader.size() &&
+                            mat_reader.get_size(mat_reader.name(index_matrix[i][j]).c_str(),row,col) &&
+                            row*col == fa_row*fa_col;
+            if(!is_volume)
+            {
+                index_name.erase(index_name.begin()+i);
+                index_data.erase(index_data.begin()+i);
+                index_matrix.erase(index_matrix.begin()+i);
+                --i;
+                continue;
+            }
+            for(unsigned int j = 0;j < index_matrix[i].size();++j)
+                mat_reader.read(index_matrix[i][j],row,col,index_data[i][j]);
+        }
     }
 
 
@@ -611,7 +685,6 @@ bool fib_data::load_from_mat(void)
         error_msg = "Empty FA matrix";
         return false;
     }
-    odf.read(mat_reader);
 
     view_item.push_back(item());
     view_item.back().name =  dir.fa.size() == 1 ? "fa":"qa";
@@ -656,10 +729,6 @@ bool fib_data::load_from_mat(void)
         std::string prefix_name(matrix_name.begin(),matrix_name.end()-1);
         if (prefix_name == "index" || prefix_name == "fa" || prefix_name == "dir")
             continue;
-        const float* buf = 0;
-        mat_reader.read(index,row,col,buf);
-        if (row*col != dim.size() || !buf)
-            continue;
         if(matrix_name.length() >= 2 && matrix_name[matrix_name.length()-2] == '_' &&
            (matrix_name[matrix_name.length()-1] == 'x' ||
             matrix_name[matrix_name.length()-1] == 'y' ||
@@ -668,6 +737,13 @@ bool fib_data::load_from_mat(void)
             continue;
         if(matrix_name[matrix_name.length()-1] >= '0' && matrix_name[matrix_name.length()-1] <= '9')
             continue;
+        // skip non-volume matrices without loading them
+        if(!mat_reader.get_size(matrix_name.c_str(),row,col) || row*col != dim.size())
+            continue;
+        const float* buf = 0;
+        mat_reader.read(index,row,col,buf);
+        if (!buf)
+            continue;
         view_item.push_back(item());
         view_item.back().name = matrix_name;
         view_item.back().image_data = tipl::make_image(buf,dim);
@@ -862,6 +938,7 @@ void fib_data::set_template_id(int new_id)
         template_I.clear();
         mni_position.clear();
         atlas_list.clear();
+        atlas_label_map.clear();
     }
 }
 extern std::vector<std::string> fa_template_list,iso_template_list,atlas_file_list;
@@ -1172,23 +1249,55 @@ void fib_data::subject2mni(tipl::pixel_index<3>& index,tipl::vector<3>& pos)
     return;
 }
 
-void fib_data::get_atlas_roi(std::shared_ptr<atlas> at,unsigned int roi_index,std::vector<tipl::vector<3,short> >& points,float& r)
+std::shared_ptr<const region_label_map> fib_data::get_atlas_label_map(std::shared_ptr<atlas> at)
+{
+    auto iter = atlas_label_map.find(at->filename);
+    if(iter != atlas_label_map.end())
+        return iter->second;
+    if(get_mni_mapping().empty())
+    {
+        error_msg = "No MNI mapping";
+        return std::shared_ptr<const region_label_map>();
+    }
+    std::shared_ptr<region_label_map> label_map(std::make_shared<region_label_map>());
+    if(!at->get_label_map(mni_position,*label_map))
+    {
+        error_msg = at->error_msg;
+        return std::shared_ptr<const region_label_map>();
+    }
+    label_map->build_voxel_index();
+    atlas_label_map[at->filename] = label_map;
+    return label_map;
+}
+void fib_data::get_atlas_roi(std::shared_ptr<atlas> at,unsigned int roi_index,std::vector<tipl::vector<3,short> >& points,float& r,bool cache_map)
 {
-    if(get_mni_mapping().empty() || !at->load_from_file())
+    points.clear();
+    // a single region is labeled in its own pass unless the whole map is cached already
+    if(!cache_map && atlas_label_map.find(at->filename) == atlas_label_map.end())
+    {
+        if(get_mni_mapping().empty() || !at->load_from_file())
+            return;
+        unsigned int thread_count = std::thread::hardware_concurrency();
+        std::vector<std::vector<tipl::vector<3,short> > > buf(thread_count);
+        r = 1.0;
+        mni_position.for_each_mt2([&](const tipl::vector<3>& mni,const tipl::pixel_index<3>& index,int id)
+        {
+            if (at->is_labeled_as(mni, roi_index))
+                buf[id].push_back(tipl::vector<3,short>(index.begin()));
+        });
+        for(int i = 0;i < buf.size();++i)
+            points.insert(points.end(),buf[i].begin(),buf[i].end());
+        return;
+    }
+    auto label_map = get_atlas_label_map(at);
+    if(!label_map)
         return;
-    unsigned int thread_count = std::thread::hardware_concurrency();
-    std::vector<std::vector<tipl::vector<3,short> > > buf(thread_count);
     r = 1.0;
-    mni_position.for_each_mt2([&](const tipl::vector<3>& mni,const tipl::pixel_index<3>& index,int id)
+    label_map->for_each_voxel(short(roi_index),[&](unsigned int index)
     {
-        if (at->is_labeled_as(mni, roi_index))
-            buf[id].push_back(tipl::vector<3,short>(index.begin()));
+        tipl::pixel_index<3> pos(index,dim);
+        points.push_back(tipl::vector<3,short>(pos.begin()));
     });
-    points.clear();
-    for(int i = 0;i < buf.size();++i)
-        points.insert(points.end(),buf[i].begin(),buf[i].end());
-
-
 }
 const tipl::image<tipl::vector<3,float>,3 >& fib_data::get_mni_mapping(void)
 {
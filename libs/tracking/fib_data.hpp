@@ -3,12 +3,22 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
 #include "prog_interface_static_link.h"
 #include "tipl/tipl.hpp"
 #include "gzip_interface.hpp"
 #include "connectometry_db.hpp"
 #include "atlas.hpp"
 
+// reads the "odf#" blocks of a fib file, or decodes the quantized "odfq#"
+// blocks into decoded_buf (see write_quantized_odf)
+bool read_odf_blocks(gz_mat_lazy_read& mat_reader,
+                     std::vector<const float*>& blocks,
+                     std::vector<unsigned int>& block_size,
+                     std::vector<std::vector<float> >& decoded_buf);
+
 struct odf_data{
 private:
     const float* odfs;
@@ -17,12 +27,13 @@ private:
     tipl::image<unsigned int,3> voxel_index_map;
     std::vector<const float*> odf_blocks;
     std::vector<unsigned int> odf_block_size;
+    std::vector<std::vector<float> > odf_block_buf;
     tipl::image<unsigned int,3> odf_block_map1;
     tipl::image<unsigned int,3> odf_block_map2;
     unsigned int half_odf_size;
 public:
     odf_data(void):odfs(nullptr){}
-    bool read(gz_mat_read& mat_reader);
+    bool read(gz_mat_lazy_read& mat_reader);
     bool has_odfs(void) const
     {
         return odfs != nullptr || !odf_blocks.empty();
@@ -56,7 +67,7 @@ public:
     std::string error_msg;
 public:
     void check_index(unsigned int index);
-    bool add_data(gz_mat_read& mat_reader);
+    bool add_data(gz_mat_lazy_read& mat_reader);
     bool set_tracking_index(int new_index);
     bool set_tracking_index(const std::string& name);
     bool set_dt_index(int new_index);
@@ -143,7 +154,7 @@ class fib_data
 public:
     mutable std::string error_msg;
     std::string report,steps,fib_file_name;
-    gz_mat_read mat_reader;
+    gz_mat_lazy_read mat_reader;
 public:
     tipl::geometry<3> dim;
     tipl::vector<3> vs;
@@ -153,6 +164,10 @@ public:
 public:
     fiber_directions dir;
     odf_data odf;
+private:
+    std::mutex odf_read_lock;
+    std::atomic<bool> odf_read_done{false}; // set after the first load attempt, including a failed one
+public:
     connectometry_db db;
     std::vector<item> view_item;
 public:
@@ -166,6 +181,7 @@ public:
     tipl::vector<3> template_vs,template_shift;
     tipl::image<float,3> template_I,template_I2;
     std::vector<std::shared_ptr<atlas> > atlas_list;
+    std::map<std::string,std::shared_ptr<region_label_map> > atlas_label_map;// by atlas file name
 public:
     void set_template_id(int new_id);
     bool load_template(void);
@@ -179,7 +195,9 @@ public:
     void mni2subject(tipl::vector<3>& pos);
     void subject2mni(tipl::vector<3>& pos);
     void subject2mni(tipl::pixel_index<3>& index,tipl::vector<3>& pos);
-    void get_atlas_roi(std::shared_ptr<atlas> at,unsigned int roi_index,std::vector<tipl::vector<3,short> >& points,float& r);
+    // subject-space labels of an atlas, computed once and then cached
+    std::shared_ptr<const region_label_map> get_atlas_label_map(std::shared_ptr<atlas> at);
+    void get_atlas_roi(std::shared_ptr<atlas> at,unsigned int roi_index,std::vector<tipl::vector<3,short> >& points,float& r,bool cache_map = true);
     const tipl::image<tipl::vector<3,float>,3 >& get_mni_mapping(void);
     bool has_reg(void)const{return thread.has_started();}
 public:
@@ -193,8 +211,21 @@ public:
     bool load_from_file(const char* file_name);
     bool load_from_mat(void);
 public:
-    bool has_odfs(void) const{return odf.has_odfs();}
-    const float* get_odf_data(unsigned int index) const{return odf.get_odf_data(index);}
+    bool has_odfs(void) const{return mat_reader.has("odfs") || mat_reader.has("odf0") || mat_reader.has("odfq0");}
+    const float* get_odf_data(unsigned int index)
+    {
+        // ODFs are loaded once at the first access, which may come from tracking threads and the view at the same time
+        if(!odf_read_done)
+        {
+            std::lock_guard<std::mutex> lock(odf_read_lock);
+            if(!odf_read_done)
+            {
+                odf.read(mat_reader);
+                odf_read_done = true;
+            }
+        }
+        return odf.get_odf_data(index);
+    }
 public:
     size_t get_name_index(const std::string& index_name) const;
     void get_index_list(std::vector<std::string>& index_list) const;
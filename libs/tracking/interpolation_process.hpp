@@ -1,57 +1,101 @@
 #ifndef INTERPOLATION_PROCESS_HPP
 #define INTERPOLATION_PROCESS_HPP
 #include <cstdlib>
+#include <numeric>
 #include "tipl/tipl.hpp"
-class tracking_data;
-class basic_interpolation
-{
-public:
-    virtual ~basic_interpolation(){}
-    virtual bool evaluate(const tracking_data& fib,
-                          const tipl::vector<3,float>& position,
-                          const tipl::vector<3,float>& ref_dir,
-                          tipl::vector<3,float>& result,
-                          float threshold,
-                          float cull_cos_angle,
-                          float dt_threshold) = 0;
-};
+#include "fib_data.hpp"
 
-class trilinear_interpolation_with_gaussian_basis : public basic_interpolation
+// The interpolation methods are defined here so that the tracking kernels
+// instantiated for each of them (see TrackingKernel) can inline evaluate.
+struct trilinear_interpolation_with_gaussian_basis
 {
-public:
-    virtual bool evaluate(const tracking_data& fib,
-                          const tipl::vector<3,float>& position,
-                          const tipl::vector<3,float>& ref_dir,
-                          tipl::vector<3,float>& result,
-                          float threshold,
-                          float cull_cos_angle,
-                          float dt_threshold);
+    bool evaluate(const tracking_data& fib,
+                  const tipl::vector<3,float>& position,
+                  const tipl::vector<3,float>& ref_dir,
+                  tipl::vector<3,float>& result,
+                  float threshold,
+                  float angle,
+                  float dt_threshold) const
+    {
+        tipl::interpolation<tipl::gaussian_radial_basis_weighting,3> tri_interpo;
+        tri_interpo.weighting.sd = 0.5;
+        if (!tri_interpo.get_location(fib.dim,position))
+            return false;
+        tipl::vector<3,float> new_dir,main_dir;
+        float total_weighting = 0.0;
+        float ww = std::accumulate(tri_interpo.ratio,tri_interpo.ratio+8,0.0)*0.5;
+        for (unsigned int index = 0;index < 8;++index)
+        {
+            unsigned int odf_space_index = tri_interpo.dindex[index];
+            if (!fib.get_dir(odf_space_index,ref_dir,main_dir,threshold,angle,dt_threshold))
+                continue;
+            float w = tri_interpo.ratio[index];
+            main_dir *= w;
+            new_dir += main_dir;
+            total_weighting += w;
+        }
+        if (total_weighting < ww)
+            return false;
+        new_dir.normalize();
+        result = new_dir;
+        return true;
+    }
 };
 
 
-class trilinear_interpolation : public basic_interpolation
+struct trilinear_interpolation
 {
-public:
-    virtual bool evaluate(const tracking_data& fib,
-                          const tipl::vector<3,float>& position,
-                          const tipl::vector<3,float>& ref_dir,
-                          tipl::vector<3,float>& result,
-                          float threshold,
-                          float cull_cos_angle,
-                          float dt_threshold);
+    bool evaluate(const tracking_data& fib,
+                  const tipl::vector<3,float>& position,
+                  const tipl::vector<3,float>& ref_dir,
+                  tipl::vector<3,float>& result,
+                  float threshold,
+                  float angle,
+                  float dt_threshold) const
+    {
+        tipl::interpolation<tipl::linear_weighting,3> tri_interpo;
+        if (!tri_interpo.get_location(fib.dim,position))
+            return false;
+        tipl::vector<3,float> new_dir,main_dir;
+        float total_weighting = 0.0;
+        for (unsigned int index = 0;index < 8;++index)
+        {
+            unsigned int odf_space_index = tri_interpo.dindex[index];
+            if (!fib.get_dir(odf_space_index,ref_dir,main_dir,threshold,angle,dt_threshold))
+                continue;
+            float w = tri_interpo.ratio[index];
+            main_dir *= w;
+            new_dir += main_dir;
+            total_weighting += w;
+        }
+        if (total_weighting < 0.5)
+            return false;
+        new_dir.normalize();
+        result = new_dir;
+        return true;
+    }
 };
 
 
-class nearest_direction : public basic_interpolation
+struct nearest_direction
 {
-public:
-    virtual bool evaluate(const tracking_data& fib,
-                          const tipl::vector<3,float>& position,
-                          const tipl::vector<3,float>& ref_dir,
-                          tipl::vector<3,float>& result,
-                          float threshold,
-                          float cull_cos_angle,
-                          float dt_threshold);
+    bool evaluate(const tracking_data& fib,
+                  const tipl::vector<3,float>& position,
+                  const tipl::vector<3,float>& ref_dir,
+                  tipl::vector<3,float>& result,
+                  float threshold,
+                  float angle,
+                  float dt_threshold) const
+    {
+        int x = std::round(position[0]);
+        int y = std::round(position[1]);
+        int z = std::round(position[2]);
+        if(!fib.dim.is_valid(x,y,z))
+            return false;
+        if(!fib.get_dir(tipl::pixel_index<3>(x,y,z,fib.dim).index(),ref_dir,result,threshold,angle,dt_threshold))
+            return false;
+        return true;
+    }
 };
 
 
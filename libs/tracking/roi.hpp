@@ -80,6 +80,8 @@ public:
     std::string report;
     std::vector<tipl::vector<3,short> > seeds;
     std::vector<float> seeds_r;
+    // a fused region keeps no Roi: its entry in inclusive or end is null, and
+    // exclusive and terminate only list the regions that were not fused
     std::vector<std::shared_ptr<Roi> > inclusive;
     std::vector<std::shared_ptr<Roi> > end;
     std::vector<std::shared_ptr<Roi> > exclusive;
@@ -87,9 +89,80 @@ public:
 public:
     std::shared_ptr<TractModel> atlas;
     unsigned int track_id = 0;
+private:
+    // Regions without super resolution are also fused into one word per voxel:
+    // bit 0 for any ROA, bit 1 for any terminative region, and one bit for each
+    // ROI or ending region. Regions that do not fit are checked through Roi.
+    static const uint32_t exclusive_bit = 1;
+    static const uint32_t terminate_bit = 2;
+    tipl::geometry<3> mask_dim;
+    std::vector<uint32_t> mask;
+    unsigned int next_bit = 2;
+    uint32_t inclusive_mask = 0;
+    uint32_t fused_mask = 0;
+    std::vector<uint32_t> inclusive_bit,end_bit;
+    static std::shared_ptr<Roi> make_roi(const tipl::geometry<3>& geo,float r,
+                                         const std::vector<tipl::vector<3,short> >& points)
+    {
+        std::shared_ptr<Roi> roi = std::make_shared<Roi>(geo,r);
+        for(unsigned int index = 0; index < points.size(); ++index)
+            roi->addPoint(points[index]);
+        return roi;
+    }
+    uint32_t mask_at(float dx,float dy,float dz) const
+    {
+        if(mask.empty())
+            return 0;
+        int x = int(std::round(dx));
+        int y = int(std::round(dy));
+        int z = int(std::round(dz));
+        if(!mask_dim.is_valid(x,y,z))
+            return 0;
+        return mask[size_t((z*mask_dim[1]+y)*mask_dim[0]+x)];
+    }
+    uint32_t mask_at(const tipl::vector<3,float>& point) const
+    {
+        return mask_at(point[0],point[1],point[2]);
+    }
+    bool fuse_region(const tipl::geometry<3>& geo,float r,
+                     const std::vector<tipl::vector<3,short> >& points,uint32_t bit)
+    {
+        if(r != 1.0f || !bit)
+            return false;
+        if(mask.empty())
+        {
+            mask_dim = geo;
+            mask.resize(geo.size());
+        }
+        else
+        if(!std::equal(geo.begin(),geo.end(),mask_dim.begin()))
+            return false;
+        for(size_t i = 0;i < points.size();++i)
+            if(geo.is_valid(points[i]))
+                mask[size_t((points[i][2]*geo[1]+points[i][1])*geo[0]+points[i][0])] |= bit;
+        return true;
+    }
+    // returns the bit assigned to the region, or 0 if it is not fused
+    uint32_t fuse_indexed_region(const tipl::geometry<3>& geo,float r,
+                                 const std::vector<tipl::vector<3,short> >& points)
+    {
+        if(next_bit >= 32 || !fuse_region(geo,r,points,uint32_t(1) << next_bit))
+            return 0;
+        return uint32_t(1) << next_bit++;
+    }
+    bool is_end_point(unsigned int index,uint32_t m,const tipl::vector<3,float>& point) const
+    {
+        return end_bit[index] ? (m & end_bit[index]) != 0 : end[index]->havePoint(point);
+    }
 public:
+    bool has_exclusive(void) const
+    {
+        return (fused_mask & exclusive_bit) || !exclusive.empty();
+    }
     bool is_excluded_point(const tipl::vector<3,float>& point) const
     {
+        if(mask_at(point) & exclusive_bit)
+            return true;
         for(unsigned int index = 0; index < exclusive.size(); ++index)
             if(exclusive[index]->havePoint(point[0],point[1],point[2]))
                 return true;
@@ -97,6 +170,8 @@ public:
     }
     bool is_terminate_point(const tipl::vector<3,float>& point) const
     {
+        if(mask_at(point) & terminate_bit)
+            return true;
         for(unsigned int index = 0; index < terminate.size(); ++index)
             if(terminate[index]->havePoint(point[0],point[1],point[2]))
                 return true;
@@ -109,20 +184,21 @@ public:
     {
         if(end.empty())
             return true;
+        uint32_t m1 = mask_at(point1),m2 = mask_at(point2);
         if(end.size() == 1)
-            return end[0]->havePoint(point1) ||
-                   end[0]->havePoint(point2);
+            return is_end_point(0,m1,point1) ||
+                   is_end_point(0,m2,point2);
         if(end.size() == 2)
-            return (end[0]->havePoint(point1) && end[1]->havePoint(point2)) ||
-                   (end[1]->havePoint(point1) && end[0]->havePoint(point2));
+            return (is_end_point(0,m1,point1) && is_end_point(1,m2,point2)) ||
+                   (is_end_point(1,m1,point1) && is_end_point(0,m2,point2));
 
         bool end_point1 = false;
         bool end_point2 = false;
         for(unsigned int index = 0; index < end.size(); ++index)
         {
-            if(end[index]->havePoint(point1[0],point1[1],point1[2]))
+            if(is_end_point(index,m1,point1))
                 end_point1 = true;
-            else if(end[index]->havePoint(point2[0],point2[1],point2[2]))
+            else if(is_end_point(index,m2,point2))
                 end_point2 = true;
             if(end_point1 && end_point2)
                 return true;
@@ -131,8 +207,16 @@ public:
     }
     bool have_include(const float* track,unsigned int buffer_size) const
     {
+        if(inclusive_mask)
+        {
+            uint32_t m = 0;
+            for(unsigned int index = 0; index < buffer_size && (m & inclusive_mask) != inclusive_mask; index += 3)
+                m |= mask_at(track[index],track[index+1],track[index+2]);
+            if((m & inclusive_mask) != inclusive_mask)
+                return false;
+        }
         for(unsigned int index = 0; index < inclusive.size(); ++index)
-            if(!inclusive[index]->included(track,buffer_size))
+            if(!inclusive_bit[index] && !inclusive[index]->included(track,buffer_size))
                 return false;
         if(atlas.get())
             return atlas->find_nearest(track,buffer_size) == track_id;
@@ -141,6 +225,7 @@ public:
     void setAtlas(std::shared_ptr<TractModel> atlas_,unsigned int track_id_)
     {
         atlas = atlas_;
+        atlas->build_index();
         track_id = track_id_;
         report += " The anatomy prior of a tractography atlas (Yeh et al., Neuroimage 178, 57-68, 2018) was used to track ";
         report += tractography_name_list[size_t(track_id)];
@@ -157,7 +242,8 @@ public:
         if(atlas.get() && handle->load_atlas())
         {
             float r = 1.0f;
-            handle->get_atlas_roi(handle->atlas_list[0],track_id,seed,r);
+            // only one track is needed, so the label map of all tracks is not built
+            handle->get_atlas_roi(handle->atlas_list[0],track_id,seed,r,false);
             name = tractography_name_list[size_t(track_id)];
         }
         else {
@@ -184,27 +270,28 @@ public:
         switch(type)
         {
         case 0: //ROI
-            inclusive.push_back(std::make_shared<Roi>(geo,r));
-            for(unsigned int index = 0; index < points.size(); ++index)
-                inclusive.back()->addPoint(points[index]);
+            inclusive_bit.push_back(fuse_indexed_region(geo,r,points));
+            inclusive_mask |= inclusive_bit.back();
+            inclusive.push_back(inclusive_bit.back() ? std::shared_ptr<Roi>() : make_roi(geo,r,points));
             report += " An ROI was placed at ";
             break;
         case 1: //ROA
-            exclusive.push_back(std::make_shared<Roi>(geo,r));
-            for(unsigned int index = 0; index < points.size(); ++index)
-                exclusive.back()->addPoint(points[index]);
+            if(fuse_region(geo,r,points,exclusive_bit))
+                fused_mask |= exclusive_bit;
+            else
+                exclusive.push_back(make_roi(geo,r,points));
             report += " An ROA was placed at ";
             break;
         case 2: //End
-            end.push_back(std::make_shared<Roi>(geo,r));
-            for(unsigned int index = 0; index < points.size(); ++index)
-                end.back()->addPoint(points[index]);
+            end_bit.push_back(fuse_indexed_region(geo,r,points));
+            end.push_back(end_bit.back() ? std::shared_ptr<Roi>() : make_roi(geo,r,points));
             report += " An ending region was placed at ";
             break;
         case 4: //Terminate
-            terminate.push_back(std::make_shared<Roi>(geo,r));
-            for(unsigned int index = 0; index < points.size(); ++index)
-                terminate.back()->addPoint(points[index]);
+            if(fuse_region(geo,r,points,terminate_bit))
+                fused_mask |= terminate_bit;
+            else
+                terminate.push_back(make_roi(geo,r,points));
             report += " A terminative region was placed at ";
             break;
         case 3: //seed
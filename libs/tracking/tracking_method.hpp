@@ -2,8 +2,6 @@
 #define STREAM_LINE_HPP
 #include <ctime>
 #include <random>
-#include <boost/mpl/vector.hpp>
-#include <boost/mpl/for_each.hpp>
 #include <deque>
 #include <vector>
 #include "tipl/tipl.hpp"
@@ -12,21 +10,28 @@
 #include "roi.hpp"
 #include "fib_data.hpp"
 
-typedef boost::mpl::vector<
-            EstimateNextDirection,
-            SmoothDir,
-            MoveTrack
-> streamline_method_process;
-
-typedef boost::mpl::vector<
-            LocateVoxel
-> voxel_tracking;
+template<bool smoothing>
+struct streamline_method_process{
+    template<class method>
+    void operator()(method& info)
+    {
+        EstimateNextDirection()(info);
+        if(smoothing)
+            SmoothDir()(info);
+        MoveTrack()(info);
+    }
+};
 
+typedef LocateVoxel voxel_tracking;
 
-typedef boost::mpl::vector<
-            EstimateNextDirectionRungeKutta4,
-            MoveTrack
-> streamline_runge_kutta_4_method_process;
+struct streamline_runge_kutta_4_method_process{
+    template<class method>
+    void operator()(method& info)
+    {
+        EstimateNextDirectionRungeKutta4()(info);
+        MoveTrack()(info);
+    }
+};
 
 
 struct TrackingParam
@@ -149,8 +154,6 @@ struct TrackingParam
 
 
 class TrackingMethod{
-private:
-    std::auto_ptr<basic_interpolation> interpolation;
 public:// Parameters
     tipl::vector<3,float> position;
     tipl::vector<3,float> dir;
@@ -172,7 +175,7 @@ public:
         dir[1] *= current_step_size_in_voxel[1];
         dir[2] *= current_step_size_in_voxel[2];
     }
-private:
+protected:
     std::shared_ptr<RoiMgr> roi_mgr;
 	std::vector<float> track_buffer;
 	mutable std::vector<float> reverse_buffer;
@@ -190,39 +193,28 @@ public:
 	{
 		return (buffer_back_pos-buffer_front_pos)/3;
 	}
-    bool get_dir(const tipl::vector<3,float>& position,
+    virtual bool get_dir(const tipl::vector<3,float>& position,
                       const tipl::vector<3,float>& ref_dir,
-                      tipl::vector<3,float>& result_dir)
-    {
-        return interpolation->evaluate(trk,position,ref_dir,result_dir,current_fa_threshold,current_tracking_angle,current_dt_threshold);
-    }
+                      tipl::vector<3,float>& result_dir) = 0;
+    virtual const float* tracking(unsigned char tracking_method,unsigned int& point_count) = 0;
 public:
-    TrackingMethod(const tracking_data& trk_,basic_interpolation* interpolation_,
+    TrackingMethod(const tracking_data& trk_,
                    std::shared_ptr<RoiMgr> roi_mgr_):
-        trk(trk_),interpolation(interpolation_),roi_mgr(roi_mgr_),init_fib_index(0)
+        trk(trk_),roi_mgr(roi_mgr_),init_fib_index(0)
 	{
 
 
 	}
-public:
-	template<class Process>
-    void operator()(Process)
-    {
-        Process()(*this);
-    }
-	template<class ProcessList>
-    void tracking(ProcessList)
-    {
-        boost::mpl::for_each<ProcessList>(boost::ref(*this));
-    }
+    virtual ~TrackingMethod(){}
 public:
 
 
 	std::vector<float>& get_track_buffer(void){return track_buffer;}
 	std::vector<float>& get_reverse_buffer(void){return reverse_buffer;}
 
-	template<class ProcessList>
-    bool start_tracking(bool smoothing)
+    // kernel is the derived TrackingKernel, so that the processes reach its get_dir directly
+    template<class ProcessList,class kernel_type>
+    bool start_tracking(kernel_type& kernel,bool smoothing)
     {
         tipl::vector<3,float> seed_pos(position);
         tipl::vector<3,float> begin_dir(dir);
@@ -245,7 +237,7 @@ public:
             buffer_back_pos += 3;
             if(roi_mgr->is_terminate_point(position))
                 break;
-            tracking(ProcessList());
+            ProcessList()(kernel);
 			// make sure that the length won't overflow
 			
 		}
@@ -258,7 +250,7 @@ public:
         forward = false;
 		do
 		{
-            tracking(ProcessList());
+            ProcessList()(kernel);
 			// make sure that the length won't overflow
             if(get_buffer_size() > current_max_steps3 || buffer_front_pos < 3)
 				return false;			
@@ -354,33 +346,6 @@ public:
             return false;
         }
 
-        const float* tracking(unsigned char tracking_method,unsigned int& point_count)
-        {
-            point_count = 0;
-            switch (tracking_method)
-            {
-            case 0:
-                if (!start_tracking<streamline_method_process>(false))
-                    return 0;
-                break;
-            case 1:
-                if (!start_tracking<streamline_runge_kutta_4_method_process>(false))
-                    return 0;
-                break;
-            case 2:
-                position[0] = std::round(position[0]);
-                position[1] = std::round(position[1]);
-                position[2] = std::round(position[2]);
-                if (!start_tracking<voxel_tracking>(true))
-                    return 0;
-                break;
-            default:
-                return 0;
-            }
-            point_count = get_point_count();
-            return get_result();
-        }
-
 	const float* get_result(void) const
 	{
                 tipl::vector<3,float> head(&*(track_buffer.begin() + buffer_front_pos));
@@ -409,4 +374,51 @@ public:
 
 
 
+// A tracking kernel is instantiated for each interpolation method and for
+// smoothing on or off, and ThreadData::new_method picks one before tracking.
+// The class is final, so the per-step get_dir calls are resolved at compile
+// time and the interpolation can be inlined.
+template<class interpolation_type,bool smoothing>
+class TrackingKernel final : public TrackingMethod{
+private:
+    interpolation_type interpolation;
+public:
+    TrackingKernel(const tracking_data& trk_,std::shared_ptr<RoiMgr> roi_mgr_):
+        TrackingMethod(trk_,roi_mgr_){}
+    virtual bool get_dir(const tipl::vector<3,float>& position,
+                      const tipl::vector<3,float>& ref_dir,
+                      tipl::vector<3,float>& result_dir)
+    {
+        return interpolation.evaluate(trk,position,ref_dir,result_dir,current_fa_threshold,current_tracking_angle,current_dt_threshold);
+    }
+    virtual const float* tracking(unsigned char tracking_method,unsigned int& point_count)
+    {
+        point_count = 0;
+        switch (tracking_method)
+        {
+        case 0:
+            if (!start_tracking<streamline_method_process<smoothing> >(*this,false))
+                return 0;
+            break;
+        case 1:
+            if (!start_tracking<streamline_runge_kutta_4_method_process>(*this,false))
+                return 0;
+            break;
+        case 2:
+            position[0] = std::round(position[0]);
+            position[1] = std::round(position[1]);
+            position[2] = std::round(position[2]);
+            if (!start_tracking<voxel_tracking>(*this,true))
+                return 0;
+            break;
+        default:
+            return 0;
+        }
+        point_count = get_point_count();
+        return get_result();
+    }
+};
+
+
+
 #endif//STREAM_LINE_HPP
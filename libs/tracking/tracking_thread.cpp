@@ -3,17 +3,49 @@
 #endif
 #include "tracking_thread.hpp"
 #include "fib_data.hpp"
-void ThreadData::push_tracts(std::vector<std::vector<float> >& local_tract_buffer)
+// number of seeding iterations taken by a thread at a time
+const unsigned int seed_chunk_size = 256;
+void ThreadData::push_tracts(tract_arena& local_tract_buffer)
 {
-    std::lock_guard<std::mutex> lock(lock_feed_function);
-    pushing_data = true;
-    for(unsigned int index = 0;index < local_tract_buffer.size();++index)
+    if(local_tract_buffer.empty())
+        return;
+    tract_batch* batch = new tract_batch;
+    batch->tracts.swap(local_tract_buffer);
+    batch->next = batch_head.load(std::memory_order_relaxed);
+    while(!batch_head.compare_exchange_weak(batch->next,batch,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed))
+        ;
+}
+void ThreadData::commit_chunk(uint64_t chunk_index,chunk_result& chunk)
+{
+    std::lock_guard<std::mutex> lock(commit_lock);
+    pending_chunk[chunk_index] = std::move(chunk);
+    // once tracking is stopped, chunks that are still missing never arrive
+    while(!pending_chunk.empty() &&
+          (pending_chunk.begin()->first == next_commit_chunk || joinning))
     {
-        track_buffer.push_back(std::vector<float>());
-        track_buffer.back().swap(local_tract_buffer[index]);
+        chunk_result& cur = pending_chunk.begin()->second;
+        next_commit_chunk = pending_chunk.begin()->first+1;
+        if(!limit_reached)
+        {
+            unsigned int seed_left = seed_limit-committed_seed_count;
+            unsigned int tract_left = tract_limit-committed_tract_count;
+            size_t n = 0;
+            while(n < cur.tracts.size() && n < tract_left && cur.tract_seed[n] <= seed_left)
+                ++n;
+            unsigned int used = std::min<unsigned int>(cur.seed_used,seed_left);
+            if(n == tract_left)
+                used = cur.tract_seed[n-1];
+            cur.tracts.resize(n);
+            push_tracts(cur.tracts);
+            committed_tract_count += n;
+            committed_seed_count += used;
+            if(committed_tract_count >= tract_limit || committed_seed_count >= seed_limit)
+                limit_reached = true;
+        }
+        pending_chunk.erase(pending_chunk.begin());
     }
-    local_tract_buffer.clear();
-    pushing_data = false;
 }
 void ThreadData::end_thread(void)
 {
@@ -26,10 +58,7 @@ void ThreadData::end_thread(void)
     }
 }
 
-void ThreadData::run_thread(TrackingMethod* method_ptr,
-                            unsigned int thread_count,
-                            unsigned int thread_id,
-                            unsigned int max_count)
+void ThreadData::run_thread(TrackingMethod* method_ptr,unsigned int thread_id)
 {
     std::auto_ptr<TrackingMethod> method(method_ptr);
     std::uniform_real_distribution<float> rand_gen(0,1),
@@ -37,99 +66,116 @@ void ThreadData::run_thread(TrackingMethod* method_ptr,
             smoothing_gen(0.0f,0.95f),
             step_gen(method->trk.vs[0]*0.5f,method->trk.vs[0]*1.5f),
             threshold_gen(0.0,1.0);
-    unsigned int iteration = thread_id; // for center seed
     float white_matter_t = param.threshold*1.2f;
+    // center seeding iterates seed locations, whereas random seeding iterates seed draws
+    uint64_t iteration_end = param.center_seed ? roi_mgr->seeds.size() : seed_limit;
     if(!roi_mgr->seeds.empty())
     try{
-        std::vector<std::vector<float> > local_track_buffer;
-        while(!joinning &&
-              !(param.stop_by_tract == 1 && tract_count[thread_id] >= max_count) &&
-              !(param.stop_by_tract == 0 && seed_count[thread_id] >= max_count) &&
-              !(param.max_seed_count > 0 && seed_count[thread_id] >= param.max_seed_count) &&
-              !(param.center_seed && iteration >= roi_mgr->seeds.size()))
+        while(!joinning && !limit_reached)
         {
-
-            if(!pushing_data && (iteration & 0x00000FFF) == 0x00000FFF && !local_track_buffer.empty())
-                push_tracts(local_track_buffer);
-            if(param.threshold == 0.0f)
+            // threads take chunks of iterations until all are used, so uneven regions do not leave threads idle
+            uint64_t chunk_index = next_chunk++;
+            uint64_t iteration = chunk_index*seed_chunk_size;
+            if(iteration >= iteration_end)
+                break;
+            uint64_t chunk_end = std::min<uint64_t>(iteration+seed_chunk_size,iteration_end);
+            // what is left of the limits bounds what this chunk can contribute
+            unsigned int seed_budget,tract_budget;
             {
-                float w = threshold_gen(seed);
-                method->current_fa_threshold = w*fa_threshold1 + (1.0f-w)*fa_threshold2;
-                white_matter_t = method->current_fa_threshold*1.2f;
+                std::lock_guard<std::mutex> lock(commit_lock);
+                seed_budget = seed_limit-committed_seed_count;
+                tract_budget = tract_limit-committed_tract_count;
             }
-            if(param.cull_cos_angle == 1.0f)
-                method->current_tracking_angle = std::cos(angle_gen(seed));
-            if(param.smooth_fraction == 1.0f)
-                method->current_tracking_smoothing = smoothing_gen(seed);
-            if(param.step_size == 0.0f)
+            chunk_result chunk;
+            // each chunk has its own random stream so that the result does not depend on the thread count
+            std::seed_seq seq{seed_base,uint32_t(chunk_index),uint32_t(chunk_index >> 32)};
+            std::mt19937 seed(seq);
+            while(!joinning && iteration < chunk_end)
             {
-                float step_size_in_mm = step_gen(seed);
-                method->current_step_size_in_voxel[0] = step_size_in_mm/method->trk.vs[0];
-                method->current_step_size_in_voxel[1] = step_size_in_mm/method->trk.vs[1];
-                method->current_step_size_in_voxel[2] = step_size_in_mm/method->trk.vs[2];
-                method->current_max_steps3 = std::round(3.0f*param.max_length/step_size_in_mm);
-                method->current_min_steps3 = std::round(3.0f*param.min_length/step_size_in_mm);
-            }
-            ++seed_count[thread_id];
-            if(param.center_seed)
-            {
-                if(!method->init(param.initial_direction,
-                    tipl::vector<3,float>(roi_mgr->seeds[iteration].x()/roi_mgr->seeds_r[iteration],
-                                           roi_mgr->seeds[iteration].y()/roi_mgr->seeds_r[iteration],
-                                           roi_mgr->seeds[iteration].z()/roi_mgr->seeds_r[iteration]),
-                                 seed))
+                if(param.threshold == 0.0f)
                 {
-                    iteration+=thread_count;
-                    continue;
+                    float w = threshold_gen(seed);
+                    method->current_fa_threshold = w*fa_threshold1 + (1.0f-w)*fa_threshold2;
+                    white_matter_t = method->current_fa_threshold*1.2f;
                 }
-                if(param.initial_direction == 0)// primary direction
-                    iteration+=thread_count;
-            }
-            else
-            {
-                // this ensure consistency
-                std::lock_guard<std::mutex> lock(lock_seed_function);
-                iteration+=thread_count;
-                unsigned int i = rand_gen(seed)*((float)roi_mgr->seeds.size()-1.0f);
-                tipl::vector<3,float> pos;
-                pos[0] = (float)roi_mgr->seeds[i].x() + rand_gen(seed)-0.5f;
-                pos[1] = (float)roi_mgr->seeds[i].y() + rand_gen(seed)-0.5f;
-                pos[2] = (float)roi_mgr->seeds[i].z() + rand_gen(seed)-0.5f;
-                if(roi_mgr->seeds_r[i] != 1.0f)
-                    pos /= roi_mgr->seeds_r[i];
-                if(!method->init(param.initial_direction,pos,seed))
-                    continue;
-            }
-            unsigned int point_count;
-            const float *result = method->tracking(param.tracking_method,point_count);
-            if(!result)
-                continue;
-            const float* end = result+point_count+point_count+point_count;
-            if(param.check_ending)
-            {
-                if(point_count < 2)
-                    continue;
-                if(result[2] > 0) // not the bottom slice
+                if(param.cull_cos_angle == 1.0f)
+                    method->current_tracking_angle = std::cos(angle_gen(seed));
+                if(param.smooth_fraction == 1.0f)
+                    method->current_tracking_smoothing = smoothing_gen(seed);
+                if(param.step_size == 0.0f)
+                {
+                    float step_size_in_mm = step_gen(seed);
+                    method->current_step_size_in_voxel[0] = step_size_in_mm/method->trk.vs[0];
+                    method->current_step_size_in_voxel[1] = step_size_in_mm/method->trk.vs[1];
+                    method->current_step_size_in_voxel[2] = step_size_in_mm/method->trk.vs[2];
+                    method->current_max_steps3 = std::round(3.0f*param.max_length/step_size_in_mm);
+                    method->current_min_steps3 = std::round(3.0f*param.min_length/step_size_in_mm);
+                }
+                if(chunk.seed_used >= seed_budget)
+                    break;
+                ++chunk.seed_used;
+                ++seed_count[thread_id];
+                if(param.center_seed)
+                {
+                    if(!method->init(param.initial_direction,
+                        tipl::vector<3,float>(roi_mgr->seeds[iteration].x()/roi_mgr->seeds_r[iteration],
+                                               roi_mgr->seeds[iteration].y()/roi_mgr->seeds_r[iteration],
+                                               roi_mgr->seeds[iteration].z()/roi_mgr->seeds_r[iteration]),
+                                     seed))
+                    {
+                        ++iteration;
+                        continue;
+                    }
+                    if(param.initial_direction == 0)// primary direction
+                        ++iteration;
+                }
+                else
                 {
-                    tipl::vector<3> p0(result),p1(result+3);
-                    p1 -= p0;
-                    p0 -= p1;
-                    if(method->trk.is_white_matter(p0,white_matter_t))
+                    ++iteration;
+                    unsigned int i = rand_gen(seed)*((float)roi_mgr->seeds.size()-1.0f);
+                    tipl::vector<3,float> pos;
+                    pos[0] = (float)roi_mgr->seeds[i].x() + rand_gen(seed)-0.5f;
+                    pos[1] = (float)roi_mgr->seeds[i].y() + rand_gen(seed)-0.5f;
+                    pos[2] = (float)roi_mgr->seeds[i].z() + rand_gen(seed)-0.5f;
+                    if(roi_mgr->seeds_r[i] != 1.0f)
+                        pos /= roi_mgr->seeds_r[i];
+                    if(!method->init(param.initial_direction,pos,seed))
                         continue;
                 }
-                tipl::vector<3> p2(end-6),p3(end-3);
-                if(*(end-1) > 0) // not the bottom slice
+                unsigned int point_count;
+                const float *result = method->tracking(param.tracking_method,point_count);
+                if(!result)
+                    continue;
+                const float* end = result+point_count+point_count+point_count;
+                if(param.check_ending)
                 {
-                    p2 -= p3;
-                    p3 -= p2;
-                    if(method->trk.is_white_matter(p3,white_matter_t))
+                    if(point_count < 2)
                         continue;
+                    if(result[2] > 0) // not the bottom slice
+                    {
+                        tipl::vector<3> p0(result),p1(result+3);
+                        p1 -= p0;
+                        p0 -= p1;
+                        if(method->trk.is_white_matter(p0,white_matter_t))
+                            continue;
+                    }
+                    tipl::vector<3> p2(end-6),p3(end-3);
+                    if(*(end-1) > 0) // not the bottom slice
+                    {
+                        p2 -= p3;
+                        p3 -= p2;
+                        if(method->trk.is_white_matter(p3,white_matter_t))
+                            continue;
+                    }
                 }
+                ++tract_count[thread_id];
+                chunk.tracts.push_back(result,end-result);
+                chunk.tract_seed.push_back(chunk.seed_used);
+                if(chunk.tracts.size() >= tract_budget)
+                    break;
             }
-            ++tract_count[thread_id];
-            local_track_buffer.push_back(std::vector<float>(result,end));
+            commit_chunk(chunk_index,chunk);
         }
-        push_tracts(local_track_buffer);
     }
     catch(...)
     {
@@ -138,35 +184,65 @@ void ThreadData::run_thread(TrackingMethod* method_ptr,
     running[thread_id] = 0;
 }
 
-bool ThreadData::fetchTracks(TractModel* handle)
+bool ThreadData::fetchTracks(tract_arena& tracks)
 {
-    if (track_buffer.empty())
+    // take all batches at once and restore the order they were pushed
+    tract_batch* batch = batch_head.exchange(nullptr,std::memory_order_acquire);
+    if(!batch)
         return false;
-
-    std::lock_guard<std::mutex> lock(lock_feed_function);
-    handle->add_tracts(track_buffer);
-    track_buffer.clear();
+    tract_batch* prev = nullptr;
+    while(batch)
+    {
+        tract_batch* next = batch->next;
+        batch->next = prev;
+        prev = batch;
+        batch = next;
+    }
+    for(batch = prev;batch;)
+    {
+        if(tracks.empty())
+            tracks.swap(batch->tracts);
+        else
+            tracks.append(batch->tracts);
+        tract_batch* next = batch->next;
+        delete batch;
+        batch = next;
+    }
     return true;
+}
 
+bool ThreadData::fetchTracks(TractModel* handle)
+{
+    tract_arena new_tracks;
+    if (!fetchTracks(new_tracks))
+        return false;
+    handle->add_tracts(new_tracks);
+    return true;
+}
+template<class interpolation_type>
+TrackingMethod* new_kernel(const tracking_data& trk,std::shared_ptr<RoiMgr> roi_mgr,bool smoothing)
+{
+    if(smoothing)
+        return new TrackingKernel<interpolation_type,true>(trk,roi_mgr);
+    return new TrackingKernel<interpolation_type,false>(trk,roi_mgr);
 }
 TrackingMethod* ThreadData::new_method(const tracking_data& trk)
 {
-
-    std::auto_ptr<basic_interpolation> interpo_method;
+    // smoothing can only be skipped when it is fixed at zero (1.0 means randomized per seed)
+    bool smoothing = (param.smooth_fraction != 0.0f);
+    TrackingMethod* method = 0;
     switch (param.interpolation_strategy)
     {
-    case 0:
-        interpo_method.reset(new trilinear_interpolation);
-        break;
     case 1:
-        interpo_method.reset(new trilinear_interpolation_with_gaussian_basis);
+        method = new_kernel<trilinear_interpolation_with_gaussian_basis>(trk,roi_mgr,smoothing);
         break;
     case 2:
-        interpo_method.reset(new nearest_direction);
+        method = new_kernel<nearest_direction>(trk,roi_mgr,smoothing);
+        break;
+    default:
+        method = new_kernel<trilinear_interpolation>(trk,roi_mgr,smoothing);
         break;
-
     }
-    TrackingMethod* method = new TrackingMethod(trk,interpo_method.release(),roi_mgr);
     method->current_fa_threshold = param.threshold;
     method->current_dt_threshold = param.dt_threshold;
     method->current_tracking_angle = param.cull_cos_angle;
@@ -237,34 +313,46 @@ void ThreadData::run(const tracking_data& trk,
         std::srand(0);
         std::random_shuffle(roi_mgr->seeds.begin(),roi_mgr->seeds.end());
     }
-    seed = std::mt19937(param.random_seed ? std::random_device()():0);
+    end_thread();
+    if(thread_count > param.termination_count)
+        thread_count = param.termination_count;
+    if(thread_count < 1)
+        thread_count = 1;
+    seed_base = param.random_seed ? std::random_device()():0;
     seed_count.clear();
     tract_count.clear();
     seed_count.resize(thread_count);
     tract_count.resize(thread_count);
     running.resize(thread_count);
-    pushing_data = false;
     std::fill(running.begin(),running.end(),1);
 
-    unsigned int count = param.termination_count;
-    end_thread();
-    if(thread_count > count)
-        thread_count = count;
-    if(thread_count < 1)
-        thread_count = 1;
-    unsigned int run_count = std::max<int>(1,count/thread_count);
-    unsigned int total_run_count = 0;
-    for (unsigned int index = 0;index < thread_count-1;++index,total_run_count += run_count)
+    tract_limit = std::numeric_limits<unsigned int>::max();
+    seed_limit = std::numeric_limits<unsigned int>::max();
+    if(param.stop_by_tract == 1)
+        tract_limit = param.termination_count;
+    else
+        seed_limit = param.termination_count;
+    if(param.max_seed_count > 0)
+        seed_limit = std::min<unsigned int>(seed_limit,param.max_seed_count);
+
+    joinning = false;
+    next_chunk = 0;
+    limit_reached = false;
+    pending_chunk.clear();
+    next_commit_chunk = 0;
+    committed_tract_count = 0;
+    committed_seed_count = 0;
+    for (unsigned int index = 0;index < thread_count-1;++index)
         threads.push_back(std::make_shared<std::future<void> >(std::async(std::launch::async,
-                [&,thread_count,index,run_count](){run_thread(new_method(trk),thread_count,index,run_count);})));
+                [&,index](){run_thread(new_method(trk),index);})));
 
     if(wait)
     {
-        run_thread(new_method(trk),thread_count,thread_count-1,count-total_run_count);
+        run_thread(new_method(trk),thread_count-1);
         for(int i = 0;i < threads.size();++i)
             threads[i]->wait();
     }
     else
         threads.push_back(std::make_shared<std::future<void> >(std::async(std::launch::async,
-                [&,thread_count,count,total_run_count](){run_thread(new_method(trk),thread_count,thread_count-1,count-total_run_count);})));
+                [&,thread_count](){run_thread(new_method(trk),thread_count-1);})));
 }
@@ -4,6 +4,11 @@
 #include <ctime>
 #include <random>
 #include <memory>
+#include <atomic>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <cstdint>
 
 #include "roi.hpp"
 #include "tracking_method.hpp"
@@ -13,7 +18,31 @@
 struct ThreadData
 {
 private:
-    std::mt19937 seed;
+    unsigned int seed_base = 0;
+    // shared by all tracking threads
+    std::atomic<uint64_t> next_chunk;
+    std::atomic<bool> limit_reached;
+private:
+    // chunks of seeding iterations finish in any order but are committed in
+    // chunk order, and the tract and seed limits are applied while committing
+    struct chunk_result{
+        tract_arena tracts;
+        std::vector<unsigned int> tract_seed;// seeds used when each tract was found
+        unsigned int seed_used = 0;
+    };
+    std::mutex commit_lock;
+    std::map<uint64_t,chunk_result> pending_chunk;
+    uint64_t next_commit_chunk = 0;
+    unsigned int tract_limit = 0,seed_limit = 0;
+    unsigned int committed_tract_count = 0,committed_seed_count = 0;
+    void commit_chunk(uint64_t chunk_index,chunk_result& chunk);
+private:
+    // tracts are handed over in batches through a lock-free list
+    struct tract_batch{
+        tract_arena tracts;
+        tract_batch* next = nullptr;
+    };
+    std::atomic<tract_batch*> batch_head;
 
 public:
     std::shared_ptr<RoiMgr> roi_mgr;
@@ -24,20 +53,21 @@ public:
     float fa_threshold1,fa_threshold2;// use only if fa_threshold=0
 
 public:
-    ThreadData(void):joinning(false),seed(0),roi_mgr(new RoiMgr){}
+    ThreadData(void):next_chunk(0),limit_reached(false),
+                     batch_head(nullptr),roi_mgr(new RoiMgr),joinning(false){}
     ~ThreadData(void)
     {
         end_thread();
+        tract_arena tracks;
+        fetchTracks(tracks);
     }
 public:
     bool joinning = false;
-    bool pushing_data = false;
 
     std::vector<std::shared_ptr<std::future<void> > > threads;
     std::vector<unsigned int> seed_count;
     std::vector<unsigned int> tract_count;
     std::vector<unsigned char> running;
-    std::mutex  lock_feed_function,lock_seed_function;
     unsigned int get_total_seed_count(void)const
     {
         if(seed_count.empty())
@@ -58,14 +88,13 @@ public:
     }
 
 public:
-    std::vector<std::vector<float> > track_buffer;
-    void push_tracts(std::vector<std::vector<float> >& local_tract_buffer);
+    void push_tracts(tract_arena& local_tract_buffer);
     void end_thread(void);
 
 public:
-    void run_thread(TrackingMethod* method_ptr,unsigned int thread_count,
-                    unsigned int thread_id,unsigned int max_count);
+    void run_thread(TrackingMethod* method_ptr,unsigned int thread_id);
     bool fetchTracks(TractModel* handle);
+    bool fetchTracks(tract_arena& tracks);
     TrackingMethod* new_method(const tracking_data& trk);
     void run(const tracking_data& trk,
              unsigned int thread_count,
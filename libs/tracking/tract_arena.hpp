@@ -0,0 +1,190 @@
+#ifndef TRACT_ARENA_HPP
+#define TRACT_ARENA_HPP
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+// A tract seen in place inside a tract_arena. It reads like the
+// std::vector<float> of x,y,z coordinates it replaces but owns nothing, so it
+// is only valid until the arena stores more points.
+template<class value_type>
+class tract_span{
+    value_type* ptr = nullptr;
+    size_t n = 0;
+public:
+    typedef value_type* iterator;
+    typedef value_type* const_iterator;
+    tract_span(void){}
+    tract_span(value_type* ptr_,size_t n_):ptr(ptr_),n(n_){}
+    template<class rhs_type>
+    tract_span(const tract_span<rhs_type>& rhs):ptr(rhs.data()),n(rhs.size()){}
+    size_t size(void) const{return n;}
+    bool empty(void) const{return n == 0;}
+    value_type* data(void) const{return ptr;}
+    value_type* begin(void) const{return ptr;}
+    value_type* end(void) const{return ptr+n;}
+    value_type& operator[](size_t i) const{return ptr[i];}
+    value_type& front(void) const{return ptr[0];}
+    value_type& back(void) const{return ptr[n-1];}
+    operator std::vector<float>(void) const{return std::vector<float>(ptr,ptr+n);}
+};
+
+// All points of a tract set in one buffer. Each stored tract keeps an id with
+// an offset and a length into the buffer, and the visible tracts are a list
+// of ids. Removing tracts only shortens that list, so the removed ids can be
+// put back later without moving any point. Points of released tracts are
+// reclaimed once they make up half of the buffer.
+class tract_arena{
+    std::vector<float> points;
+    std::vector<size_t> offset;
+    std::vector<unsigned int> length;
+    std::vector<unsigned int> order;// visible tract -> stored id
+    size_t garbage = 0;
+public:
+    size_t size(void) const{return order.size();}
+    bool empty(void) const{return order.empty();}
+    tract_span<const float> operator[](size_t i) const{return stored(order[i]);}
+    tract_span<float> operator[](size_t i)
+    {
+        unsigned int id = order[i];
+        return tract_span<float>(points.data()+offset[id],length[id]);
+    }
+    tract_span<const float> stored(unsigned int id) const
+    {
+        return tract_span<const float>(points.data()+offset[id],length[id]);
+    }
+    unsigned int id(size_t i) const{return order[i];}
+    size_t point_size(void) const{return points.size();}
+public:
+    void reserve(size_t tract_count,size_t float_count)
+    {
+        offset.reserve(offset.size()+tract_count);
+        length.reserve(length.size()+tract_count);
+        order.reserve(order.size()+tract_count);
+        points.reserve(points.size()+float_count);
+    }
+    // keeps the points without making them visible
+    unsigned int store(const float* p,size_t n)
+    {
+        offset.push_back(points.size());
+        length.push_back(n);
+        points.insert(points.end(),p,p+n);
+        return offset.size()-1;
+    }
+    void push_back(const float* p,size_t n){order.push_back(store(p,n));}
+    void push_back(const std::vector<float>& t){push_back(t.data(),t.size());}
+    template<class value_type>
+    void push_back(const tract_span<value_type>& t){push_back(t.data(),t.size());}
+    void restore(unsigned int id){order.push_back(id);}
+    // hides the flagged visible tracts; their ids remain valid for restore
+    void remove(const std::vector<char>& flag)
+    {
+        size_t count = 0;
+        for(size_t i = 0;i < order.size();++i)
+            if(!flag[i])
+                order[count++] = order[i];
+        order.resize(count);
+    }
+    // gives up a hidden tract for good
+    void release(unsigned int id)
+    {
+        garbage += length[id];
+        length[id] = 0;
+        if(garbage > points.size()/2)
+            collect_garbage();
+    }
+    // keeps the first n visible tracts and releases the rest
+    void resize(size_t n)
+    {
+        if(n >= order.size())
+            return;
+        std::vector<unsigned int> dropped(order.begin()+n,order.end());
+        order.resize(n);
+        for(size_t i = 0;i < dropped.size();++i)
+            release(dropped[i]);
+    }
+    // gives visible tract i new points
+    void replace(size_t i,const float* p,size_t n)
+    {
+        unsigned int old_id = order[i];
+        if(n <= length[old_id])
+        {
+            std::copy(p,p+n,points.begin()+offset[old_id]);
+            garbage += length[old_id]-n;
+            length[old_id] = n;
+            return;
+        }
+        order[i] = store(p,n);
+        release(old_id);
+    }
+    void clear(void)
+    {
+        points.clear();
+        offset.clear();
+        length.clear();
+        order.clear();
+        garbage = 0;
+    }
+    void swap(tract_arena& rhs)
+    {
+        points.swap(rhs.points);
+        offset.swap(rhs.offset);
+        length.swap(rhs.length);
+        order.swap(rhs.order);
+        std::swap(garbage,rhs.garbage);
+    }
+    // moves the released points out of the buffer, ids are kept
+    void collect_garbage(void)
+    {
+        std::vector<float> new_points;
+        new_points.reserve(points.size()-garbage);
+        for(size_t id = 0;id < offset.size();++id)
+        {
+            size_t new_offset = new_points.size();
+            new_points.insert(new_points.end(),
+                              points.begin()+offset[id],
+                              points.begin()+offset[id]+length[id]);
+            offset[id] = new_offset;
+        }
+        points.swap(new_points);
+        garbage = 0;
+    }
+    // rebuilds the arena from the visible tracts in order. Ids change, so this
+    // is only for when no hidden tract is kept for restore.
+    void shrink_to_visible(void)
+    {
+        if(!garbage && order.size() == offset.size())
+            return;
+        tract_arena visible;
+        visible.append(*this);
+        swap(visible);
+    }
+public:
+    void append(const tract_arena& rhs)
+    {
+        size_t n = 0;
+        for(size_t i = 0;i < rhs.size();++i)
+            n += rhs.length[rhs.order[i]];
+        reserve(rhs.size(),n);
+        for(size_t i = 0;i < rhs.size();++i)
+            push_back(rhs[i]);
+    }
+    void assign(const std::vector<std::vector<float> >& tracts)
+    {
+        clear();
+        size_t n = 0;
+        for(size_t i = 0;i < tracts.size();++i)
+            n += tracts[i].size();
+        reserve(tracts.size(),n);
+        for(size_t i = 0;i < tracts.size();++i)
+            push_back(tracts[i]);
+    }
+    void get(std::vector<std::vector<float> >& tracts) const
+    {
+        tracts.resize(order.size());
+        for(size_t i = 0;i < order.size();++i)
+            tracts[i] = (*this)[i];
+    }
+};
+
+#endif//TRACT_ARENA_HPP
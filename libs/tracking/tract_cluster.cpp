@@ -112,7 +112,7 @@ void TractCluster::merge_tract(unsigned int tract_index1,unsigned int tract_inde
     }
 }
 
-void TractCluster::add_tracts(const std::vector<std::vector<float> >& tracks)
+void TractCluster::add_tracts(const tract_arena& tracks)
 {
     tract_labels.clear();
     tract_passed_voxels.clear();
@@ -3,6 +3,7 @@
 #include <vector>
 #include "tipl/tipl.hpp"
 #include <map>
+#include "tract_arena.hpp"
 
 struct Cluster
 {
@@ -18,7 +19,7 @@ protected:
     void sort_cluster(void);
 public:
     virtual ~BasicCluster(void){}
-    virtual void add_tracts(const std::vector<std::vector<float> >& tracks) = 0;
+    virtual void add_tracts(const tract_arena& tracks) = 0;
     virtual void run_clustering(void) = 0;
 public:
     unsigned int get_cluster_count(void) const
@@ -45,7 +46,7 @@ public:
     virtual ~FeatureBasedClutering(void) {}
 
 public:
-    virtual void add_tracts(const std::vector<std::vector<float> >& tracks)
+    virtual void add_tracts(const tract_arena& tracks)
     {
         for(int i = 0;i < tracks.size();++i)
             if(!tracks[i].empty())
@@ -109,7 +110,7 @@ private:
 
 public:
     TractCluster(const float* param);
-    void add_tracts(const std::vector<std::vector<float> >& tracks);
+    void add_tracts(const tract_arena& tracks);
 	void run_clustering(void){sort_cluster();}
 
 };
@@ -0,0 +1,91 @@
+#ifndef TRACT_INDEX_HPP
+#define TRACT_INDEX_HPP
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Uniform grid over the first point of each tract, plus a bounding box per
+// tract. Used to prune tract-to-tract distance queries: get_candidates returns
+// every tract whose first point is within L1 distance cell_size of p, and
+// box_distance gives a lower bound of the distance from p to any tract point.
+class tract_index{
+    float cell_size = 1.0f;
+    std::vector<std::pair<uint64_t,unsigned int> > cells;
+    std::vector<float> box; // min x,y,z and max x,y,z of each tract
+    unsigned int tract_count = 0;
+private:
+    static uint64_t key(int x,int y,int z)
+    {
+        const int64_t offset = 1 << 20;
+        return (uint64_t(x+offset) << 42) | (uint64_t(y+offset) << 21) | uint64_t(z+offset);
+    }
+    int to_cell(float v) const
+    {
+        return std::max<int>(-(1 << 20)+1,std::min<int>((1 << 20)-2,int(std::floor(v/cell_size))));
+    }
+public:
+    template<class tracts_type>
+    void build(const tracts_type& tracts,float cell_size_)
+    {
+        // slightly enlarged so that rounding never pushes a neighbor two cells away
+        cell_size = std::max<float>(cell_size_,1.0e-3f)*1.001f;
+        tract_count = tracts.size();
+        cells.clear();
+        cells.reserve(tracts.size());
+        box.resize(tracts.size()*6);
+        for(unsigned int i = 0;i < tracts.size();++i)
+        {
+            float* b = &box[i*6];
+            if(tracts[i].size() < 3)
+            {
+                std::fill(b,b+3,1.0e20f);
+                std::fill(b+3,b+6,-1.0e20f);
+                continue;
+            }
+            cells.push_back(std::make_pair(key(to_cell(tracts[i][0]),to_cell(tracts[i][1]),to_cell(tracts[i][2])),i));
+            std::copy(&tracts[i][0],&tracts[i][0]+3,b);
+            std::copy(&tracts[i][0],&tracts[i][0]+3,b+3);
+            for(unsigned int j = 3;j < tracts[i].size();j += 3)
+                for(unsigned int d = 0;d < 3;++d)
+                {
+                    b[d] = std::min<float>(b[d],tracts[i][j+d]);
+                    b[d+3] = std::max<float>(b[d+3],tracts[i][j+d]);
+                }
+        }
+        std::sort(cells.begin(),cells.end());
+    }
+    unsigned int size(void) const{return tract_count;}
+    // candidates are returned in ascending tract order
+    void get_candidates(const float* p,std::vector<unsigned int>& result) const
+    {
+        result.clear();
+        int x = to_cell(p[0]),y = to_cell(p[1]),z = to_cell(p[2]);
+        for(int dx = -1;dx <= 1;++dx)
+            for(int dy = -1;dy <= 1;++dy)
+                for(int dz = -1;dz <= 1;++dz)
+                {
+                    uint64_t k = key(x+dx,y+dy,z+dz);
+                    auto iter = std::lower_bound(cells.begin(),cells.end(),std::make_pair(k,0u));
+                    for(;iter != cells.end() && iter->first == k;++iter)
+                        result.push_back(iter->second);
+                }
+        std::sort(result.begin(),result.end());
+    }
+    float box_distance(unsigned int i,const float* p) const
+    {
+        const float* b = &box[i*6];
+        float dis = 0.0f;
+        for(unsigned int d = 0;d < 3;++d)
+        {
+            if(p[d] < b[d])
+                dis += b[d]-p[d];
+            else
+            if(p[d] > b[d+3])
+                dis += p[d]-b[d+3];
+        }
+        return dis;
+    }
+};
+
+#endif // TRACT_INDEX_HPP
@@ -5,6 +5,8 @@
 #include <iterator>
 #include <set>
 #include <map>
+#include <mutex>
+#include <atomic>
 #include "roi.hpp"
 #include "tract_model.hpp"
 #include "prog_interface_static_link.h"
@@ -149,7 +151,7 @@ struct TrackVis
     static bool save_to_file(const char* file_name,
                              tipl::geometry<3> geo,
                              tipl::vector<3> vs,
-                             const std::vector<std::vector<float> >& tract_data,
+                             const tract_arena& tract_data,
                              const std::vector<std::vector<float> >& scalar)
     {
         gz_ostream out;
@@ -203,12 +205,16 @@ void TractModel::add(const TractModel& rhs)
     for(unsigned int index = 0;index < rhs.redo_size.size();++index)
         redo_size.push_back(std::make_pair(rhs.redo_size[index].first + tract_data.size(),
                                            rhs.redo_size[index].second));
-    tract_data.insert(tract_data.end(),rhs.tract_data.begin(),rhs.tract_data.end());
+    tract_data.append(rhs.tract_data);
+    nearest_index.reset();
     tract_color.insert(tract_color.end(),rhs.tract_color.begin(),rhs.tract_color.end());
     tract_tag.insert(tract_tag.end(),rhs.tract_tag.begin(),rhs.tract_tag.end());
-    deleted_tract_data.insert(deleted_tract_data.end(),
-                              rhs.deleted_tract_data.begin(),
-                              rhs.deleted_tract_data.end());
+    // the deleted tracts of rhs are stored hidden so that undo can bring them back
+    for(unsigned int index = 0;index < rhs.deleted_tract_id.size();++index)
+    {
+        auto t = rhs.tract_data.stored(rhs.deleted_tract_id[index]);
+        deleted_tract_id.push_back(tract_data.store(t.data(),t.size()));
+    }
     deleted_tract_color.insert(deleted_tract_color.end(),
                                rhs.deleted_tract_color.begin(),
                                rhs.deleted_tract_color.end());
@@ -369,12 +375,13 @@ bool TractModel::load_from_file(const char* file_name_,bool append)
         loaded_tract_cluster.swap(tract_cluster);
     else
         tract_cluster.clear();
-    loaded_tract_data.swap(tract_data);
+    tract_data.assign(loaded_tract_data);
+    nearest_index.reset();
     tract_color.clear();
     tract_color.resize(tract_data.size());
     tract_tag.clear();
     tract_tag.resize(tract_data.size());
-    deleted_tract_data.clear();
+    deleted_tract_id.clear();
     deleted_tract_color.clear();
     deleted_tract_tag.clear();
     deleted_count.clear();
@@ -436,16 +443,17 @@ bool TractModel::save_data_to_file(const char* file_name,const std::string& inde
 //---------------------------------------------------------------------------
 bool TractModel::save_tracts_in_native_space(const char* file_name,tipl::image<tipl::vector<3,float>,3 > native_position)
 {
-    std::vector<std::vector<float> > keep_tract_data(tract_data);
+    tract_arena keep_tract_data(tract_data);
     tipl::par_for(tract_data.size(),[&](int i)
     {
-        for(int j = 0;j < tract_data[i].size();j += 3)
+        auto t = tract_data[i];
+        for(int j = 0;j < t.size();j += 3)
         {
-            tipl::vector<3> pos(&tract_data[i][0]+j),new_pos;
+            tipl::vector<3> pos(&t[0]+j),new_pos;
             tipl::estimate(native_position,pos,new_pos);
-            tract_data[i][j] = new_pos[0];
-            tract_data[i][j+1] = new_pos[1];
-            tract_data[i][j+2] = new_pos[2];
+            t[j] = new_pos[0];
+            t[j+1] = new_pos[1];
+            t[j+2] = new_pos[2];
         }
     });
     bool result = save_tracts_to_file(file_name);
@@ -482,7 +490,7 @@ bool TractModel::save_tracts_to_file(const char* file_name_)
         unsigned int NaN = 0x7FC00000;
         for(size_t i = 0;i < tract_data.size();++i)
         {
-            std::vector<float> buf(tract_data[i]);
+            std::vector<float> buf(tract_data[i].begin(),tract_data[i].end());
             tipl::multiply_constant(buf,handle->vs[0]);
             out.write((char*)&buf[0],buf.size()*sizeof(float));
             out.write((char*)&NaN,sizeof(NaN));
@@ -841,7 +849,7 @@ bool TractModel::save_all(const char* file_name_,const std::vector<std::shared_p
 //---------------------------------------------------------------------------
 bool TractModel::save_transformed_tracts_to_file(const char* file_name,const float* transform,bool end_point)
 {
-    std::vector<std::vector<float> > new_tract_data(tract_data);
+    tract_arena new_tract_data(tract_data);
     for(unsigned int i = 0;i < tract_data.size();++i)
         for(unsigned int j = 0;j < tract_data[i].size();j += 3)
         tipl::vector_transformation(&(new_tract_data[i][j]),
@@ -1022,35 +1030,77 @@ void TractModel::select(float select_angle,
 //---------------------------------------------------------------------------
 void TractModel::release_tracts(std::vector<std::vector<float> >& released_tracks)
 {
+    tract_data.get(released_tracks);
+    tract_arena empty_tracts;
+    release_tracts(empty_tracts);
+}
+//---------------------------------------------------------------------------
+void TractModel::release_tracts(tract_arena& released_tracks)
+{
+    // the deleted tracts live in the same arena and go with it
+    bool has_deleted = !deleted_tract_id.empty();
     released_tracks.clear();
     released_tracks.swap(tract_data);
+    if(has_deleted)
+        released_tracks.shrink_to_visible();
+    clear_deleted();
     tract_color.clear();
     tract_tag.clear();
-    redo_size.clear();
+    nearest_index.reset();
+}
+//---------------------------------------------------------------------------
+void TractModel::erase_tracts(std::vector<char>& erased)
+{
+    // empty tracts are dropped as well, colors and tags follow in one pass
+    size_t count = 0;
+    for(size_t index = 0;index < tract_data.size();++index)
+    {
+        if(!erased[index] && tract_data[index].empty())
+        {
+            tract_data.release(tract_data.id(index));
+            erased[index] = 1;
+        }
+        if(erased[index])
+            continue;
+        tract_color[count] = tract_color[index];
+        tract_tag[count] = tract_tag[index];
+        ++count;
+    }
+    tract_data.remove(erased);
+    tract_color.resize(count);
+    tract_tag.resize(count);
+    nearest_index.reset();
 }
 //---------------------------------------------------------------------------
 void TractModel::erase_empty(void)
 {
-    tract_color.erase(std::remove_if(tract_color.begin(),tract_color.end(),
-                        [&](const unsigned int& data){return tract_data[&data-&tract_color[0]].empty();}), tract_color.end());
-    tract_tag.erase(std::remove_if(tract_tag.begin(),tract_tag.end(),
-                        [&](const unsigned int& data){return tract_data[&data-&tract_tag[0]].empty();}), tract_tag.end());
-    tract_data.erase(std::remove_if(tract_data.begin(),tract_data.end(),
-                        [&](const std::vector<float>& data){return data.empty();}), tract_data.end() );
+    std::vector<char> erased(tract_data.size());
+    erase_tracts(erased);
 }
 //---------------------------------------------------------------------------
 void TractModel::delete_tracts(const std::vector<unsigned int>& tracts_to_delete)
 {
     if (tracts_to_delete.empty())
         return;
+    // deleted tracts only leave the visible list, their points stay for undo
+    std::vector<char> deleted(tract_data.size());
+    unsigned int count = 0;
+    deleted_tract_id.reserve(deleted_tract_id.size()+tracts_to_delete.size());
+    deleted_tract_color.reserve(deleted_tract_color.size()+tracts_to_delete.size());
+    deleted_tract_tag.reserve(deleted_tract_tag.size()+tracts_to_delete.size());
     for (unsigned int index = 0;index < tracts_to_delete.size();++index)
     {
-        deleted_tract_data.push_back(std::move(tract_data[tracts_to_delete[index]]));
-        deleted_tract_color.push_back(tract_color[tracts_to_delete[index]]);
-        deleted_tract_tag.push_back(tract_tag[tracts_to_delete[index]]);
-    }
-    erase_empty();
-    deleted_count.push_back(tracts_to_delete.size());
+        unsigned int i = tracts_to_delete[index];
+        if(i >= tract_data.size() || deleted[i])
+            continue;
+        deleted[i] = 1;
+        deleted_tract_id.push_back(tract_data.id(i));
+        deleted_tract_color.push_back(tract_color[i]);
+        deleted_tract_tag.push_back(tract_tag[i]);
+        ++count;
+    }
+    erase_tracts(deleted);
+    deleted_count.push_back(count);
     is_cut.push_back(0);
     // no redo once track deleted
     redo_size.clear();
@@ -1071,13 +1121,33 @@ void TractModel::select_tracts(const std::vector<unsigned int>& tracts_to_select
     delete_tracts(not_selected);
 }
 //---------------------------------------------------------------------------
+void TractModel::build_index(void)
+{
+    if(nearest_index.get() && nearest_index->size() == tract_data.size())
+        return;
+    std::shared_ptr<tract_index> new_index(new tract_index);
+    new_index->build(tract_data,30.0f/handle->vs[0]);
+    nearest_index = new_index;
+}
+//---------------------------------------------------------------------------
 unsigned int TractModel::find_nearest(const float* trk,unsigned int length,bool contain)
 {
     auto norm1 = [](const float* v1,const float* v2){return std::fabs(v1[0]-v2[0])+std::fabs(v1[1]-v2[1])+std::fabs(v1[2]-v2[2]);};
     float best_distance = contain ? 100.0f : 30.0f/handle->vs[0];
     unsigned int best_index = tract_data.size()-1;
-    for(int i = 0;i < tract_data.size();++i)
-    {
+    // the index is only used when built beforehand by build_index (not thread-safe to build here)
+    std::shared_ptr<tract_index> index = nearest_index;
+    if(index.get() && index->size() != tract_data.size())
+        index.reset();
+    // without the containing condition, only tracts starting within best_distance can match
+    std::vector<unsigned int> candidates;
+    bool use_candidates = index.get() && !contain;
+    if(use_candidates)
+        index->get_candidates(trk,candidates);
+    unsigned int count = use_candidates ? candidates.size() : tract_data.size();
+    for(unsigned int c = 0;c < count;++c)
+    {
+        unsigned int i = use_candidates ? candidates[c] : c;
         bool skip = false;
         float max_dis = 0.0f;
         if(contain)
@@ -1089,6 +1159,9 @@ unsigned int TractModel::find_nearest(const float* trk,unsigned int length,bool
         if(norm1(&tract_data[i][0],trk) > best_distance ||
             norm1(&tract_data[i][tract_data[i].size()-3],trk+length-3) > best_distance)
             continue;
+        // the bounding box distance is a lower bound of max_dis
+        if(index.get() && index->box_distance(i,trk) > best_distance)
+            continue;
         if(!contain)
         for(int m = 0;m < tract_data[i].size();m += 6)
         {
@@ -1127,13 +1200,18 @@ unsigned int TractModel::find_nearest(const float* trk,unsigned int length,bool
 void TractModel::delete_repeated(double d)
 {
     auto norm1 = [](const float* v1,const float* v2){return std::fabs(v1[0]-v2[0])+std::fabs(v1[1]-v2[1])+std::fabs(v1[2]-v2[2]);};
-    std::vector<bool> repeated(tract_data.size());
-    tipl::par_for(tract_data.size(),[&](int i)
-    {
-        if(!repeated[i])
+    // repeated tracts have their first points within d, so only tracts in the neighboring cells are compared
+    tract_index index;
+    index.build(tract_data,float(d));
+    std::vector<std::vector<unsigned int> > candidates(std::max<unsigned int>(1,std::thread::hardware_concurrency()));
+    std::vector<char> repeated(tract_data.size());
+    tipl::par_for2(tract_data.size(),[&](unsigned int i,unsigned int id)
+    {
+        if(!repeated[i] && !tract_data[i].empty())
         {
-        for(int j = i+1;j < tract_data.size();++j)
-            if(!repeated[j])
+        index.get_candidates(&tract_data[i][0],candidates[id]);
+        for(unsigned int j : candidates[id])
+            if(j > i && !repeated[j])
             {
                 // check endpoints
                 if(norm1(&tract_data[i][0],&tract_data[j][0]) > d ||
@@ -1168,7 +1246,7 @@ void TractModel::delete_repeated(double d)
                     repeated[j] = true;
             }
         }
-    });
+    },candidates.size());
     std::vector<unsigned int> track_to_delete;
     for(unsigned int i = 0;i < tract_data.size();++i)
         if(repeated[i])
@@ -1219,7 +1297,7 @@ void TractModel::cut(float select_angle,const std::vector<tipl::vector<3,float>
     is_cut.back() = cur_cut_id;
     for (unsigned int index = 0;index < new_tract.size();++index)
     {
-        tract_data.push_back(std::move(new_tract[index]));
+        tract_data.push_back(new_tract[index]);
         tract_color.push_back(new_tract_color[index]);
         tract_tag.push_back(cur_cut_id);
     }
@@ -1260,7 +1338,7 @@ void TractModel::cut_by_slice(unsigned int dim, unsigned int pos,bool greater)
     for (unsigned int index = 0;index < new_tract.size();++index)
     if(new_tract[index].size() >= 6)
         {
-            tract_data.push_back(std::move(new_tract[index]));
+            tract_data.push_back(new_tract[index]);
             tract_color.push_back(new_tract_color[index]);
             tract_tag.push_back(cur_cut_id);
         }
@@ -1285,7 +1363,7 @@ void TractModel::filter_by_roi(std::shared_ptr<RoiMgr> roi_mgr)
             tracts_to_delete.push_back(index);
             continue;
         }
-        if(!roi_mgr->exclusive.empty())
+        if(roi_mgr->has_exclusive())
         {
             for(unsigned int i = 0;i < tract_data[index].size();i+=3)
                 if(roi_mgr->is_excluded_point(tipl::vector<3,float>(tract_data[index][i],
@@ -1515,10 +1593,20 @@ bool TractModel::trim(void)
 void TractModel::clear_deleted(void)
 {
     deleted_count.clear();
-    deleted_tract_data.clear();
+    deleted_tract_id.clear();
     deleted_tract_color.clear();
     deleted_tract_tag.clear();
+    is_cut.clear();
     redo_size.clear();
+    // no tract is hidden any more, so the arena keeps only the visible points
+    tract_data.shrink_to_visible();
+}
+//---------------------------------------------------------------------------
+void TractModel::get_deleted_tracts(tract_arena& tracts) const
+{
+    tracts.clear();
+    for(unsigned int index = 0;index < deleted_tract_id.size();++index)
+        tracts.push_back(tract_data.stored(deleted_tract_id[index]));
 }
 
 void TractModel::undo(void)
@@ -1526,22 +1614,30 @@ void TractModel::undo(void)
     if (deleted_count.empty())
         return;
     redo_size.push_back(std::make_pair((unsigned int)tract_data.size(),deleted_count.back()));
+    tract_data.reserve(deleted_count.back(),0);
+    tract_color.reserve(tract_color.size()+deleted_count.back());
+    tract_tag.reserve(tract_tag.size()+deleted_count.back());
     for (unsigned int index = 0;index < deleted_count.back();++index)
     {
-        tract_data.push_back(std::move(deleted_tract_data.back()));
+        tract_data.restore(deleted_tract_id.back());
         tract_color.push_back(deleted_tract_color.back());
         tract_tag.push_back(deleted_tract_tag.back());
-        deleted_tract_data.pop_back();
+        deleted_tract_id.pop_back();
         deleted_tract_color.pop_back();
         deleted_tract_tag.pop_back();
     }
+    nearest_index.reset();
     // handle the cut situation
     if(is_cut.back())
     {
+        std::vector<char> cut_pieces(tract_data.size());
         for(int i = 0;i < tract_tag.size();++i)
             if(tract_tag[i] == is_cut.back())
-                tract_data[i].clear();
-        erase_empty();
+            {
+                cut_pieces[i] = 1;
+                tract_data.release(tract_data.id(i));
+            }
+        erase_tracts(cut_pieces);
     }
     is_cut.pop_back();
     deleted_count.pop_back();
@@ -1571,40 +1667,120 @@ void TractModel::add_tracts(std::vector<std::vector<float> >& new_tracks)
 //---------------------------------------------------------------------------
 void TractModel::add_tracts(std::vector<std::vector<float> >& new_tract,tipl::rgb color)
 {
-    tract_data.reserve(tract_data.size()+new_tract.size());
-
-    for (unsigned int index = 0;index < new_tract.size();++index)
+    tract_arena new_arena;
+    new_arena.assign(new_tract);
+    new_tract.clear();
+    add_tracts(new_arena,color);
+}
+//---------------------------------------------------------------------------
+void TractModel::add_tracts(tract_arena& new_tracks)
+{
+    add_tracts(new_tracks,tract_color.empty() ? tipl::rgb(255,160,60) : tipl::rgb(tract_color.back()));
+}
+//---------------------------------------------------------------------------
+void TractModel::add_tracts(tract_arena& new_tract,tipl::rgb color)
+{
+    // an empty model takes over the arena without copying any point
+    if(tract_data.empty() && deleted_tract_id.empty())
     {
-        if (new_tract[index].empty())
-            continue;
-        tract_data.push_back(std::move(new_tract[index]));
-        tract_color.push_back(color);
-        tract_tag.push_back(0);
+        tract_data.swap(new_tract);
+        new_tract.clear();
     }
+    else
+    {
+        tract_data.append(new_tract);
+        new_tract.clear();
+    }
+    tract_color.resize(tract_data.size(),color);
+    tract_tag.resize(tract_data.size(),0);
+    erase_empty();
 }
-
-void TractModel::add_tracts(std::vector<std::vector<float> >& new_tract, unsigned int length_threshold)
+//---------------------------------------------------------------------------
+void TractModel::add_tracts(tract_arena& new_tract, unsigned int length_threshold)
 {
-    tract_data.reserve(tract_data.size()+new_tract.size()/2.0);
+    nearest_index.reset();
     tipl::rgb def_color(200,100,30);
     for (unsigned int index = 0;index < new_tract.size();++index)
     {
         if (new_tract[index].size()/3-1 < length_threshold)
             continue;
-        tract_data.push_back(std::move(new_tract[index]));
+        tract_data.push_back(new_tract[index]);
         tract_color.push_back(def_color);
         tract_tag.push_back(0);
     }
+    new_tract.clear();
 }
 //---------------------------------------------------------------------------
+// Density maps are accumulated in z-slabs. Each thread buffers its updates per
+// slab and applies a full buffer under the slab lock, so the volume is never
+// copied per thread.
+template<class item_type>
+class slab_buffer{
+    static const unsigned int flush_size = 4096;
+    std::vector<std::mutex> locks;
+    std::vector<std::vector<std::vector<item_type> > > buffer;
+public:
+    slab_buffer(unsigned int slab_count,unsigned int thread_count):
+        locks(slab_count),buffer(thread_count,std::vector<std::vector<item_type> >(slab_count)){}
+    template<class fun_type>
+    void push(unsigned int id,unsigned int slab,const item_type& item,fun_type&& apply)
+    {
+        auto& b = buffer[id][slab];
+        b.push_back(item);
+        if(b.size() < flush_size)
+            return;
+        std::lock_guard<std::mutex> lock(locks[slab]);
+        apply(slab,b);
+        b.clear();
+    }
+    // called after all threads finished pushing
+    template<class fun_type>
+    void flush(fun_type&& apply)
+    {
+        tipl::par_for(locks.size(),[&](unsigned int slab)
+        {
+            for(auto& each : buffer)
+                if(!each[slab].empty())
+                {
+                    apply(slab,each[slab]);
+                    std::vector<item_type>().swap(each[slab]);
+                }
+        });
+    }
+};
+const unsigned int tdi_slab_depth = 4;
+//---------------------------------------------------------------------------
 void TractModel::get_density_map(tipl::image<unsigned int,3>& mapping,
                                  const tipl::matrix<4,4,float>& transformation,bool endpoint)
 {
     tipl::geometry<3> geometry = mapping.geometry();
+    unsigned int slab_size = mapping.plane_size()*tdi_slab_depth;
+    unsigned int thread_count = std::max<unsigned int>(1,std::thread::hardware_concurrency());
+    slab_buffer<unsigned int> buffer((geometry.size()+slab_size-1)/slab_size,thread_count);
+    std::vector<std::vector<unsigned int> > point_list(thread_count);
+    auto apply = [&](unsigned int,const std::vector<unsigned int>& list)
+    {
+        for(unsigned int pos : list)
+            ++mapping[pos];
+    };
+    std::atomic<bool> aborted(false); // set by thread 0, read by every worker
     begin_prog("calculating");
-    for (unsigned int i = 0;check_prog(i,tract_data.size());++i)
+    tipl::par_for2(tract_data.size(),[&](unsigned int i,unsigned int id)
     {
-        std::set<unsigned int> point_set;
+        if(aborted)
+            return;
+        if(!id)
+        {
+            check_prog(i,tract_data.size());
+            if(prog_aborted())
+            {
+                aborted = true;
+                return;
+            }
+        }
+        // a track counts once per voxel
+        auto& points = point_list[id];
+        points.clear();
         for (unsigned int j = 0;j < tract_data[i].size();j+=3)
         {
             if(j && endpoint)
@@ -1618,13 +1794,17 @@ void TractModel::get_density_map(tipl::image<unsigned int,3>& mapping,
             int z = std::round(tmp[2]);
             if (!geometry.is_valid(x,y,z))
                 continue;
-            point_set.insert((z*mapping.height()+y)*mapping.width()+x);
+            unsigned int pos = (z*mapping.height()+y)*mapping.width()+x;
+            if(points.empty() || points.back() != pos)
+                points.push_back(pos);
         }
-
-        std::vector<unsigned int> point_list(point_set.begin(),point_set.end());
-        for(unsigned int j = 0;j < point_list.size();++j)
-            ++mapping[point_list[j]];
-    }
+        std::sort(points.begin(),points.end());
+        points.erase(std::unique(points.begin(),points.end()),points.end());
+        for(unsigned int pos : points)
+            buffer.push(id,pos/slab_size,pos,apply);
+    },thread_count);
+    buffer.flush(apply);
+    check_prog(0,0);
 }
 //---------------------------------------------------------------------------
 void TractModel::get_density_map(
@@ -1632,9 +1812,22 @@ void TractModel::get_density_map(
         const tipl::matrix<4,4,float>& transformation,bool endpoint)
 {
     tipl::geometry<3> geometry = mapping.geometry();
-    tipl::image<float,3> map_r(geometry),
-                            map_g(geometry),map_b(geometry);
-    for (unsigned int i = 0;i < tract_data.size();++i)
+    unsigned int slab_size = mapping.plane_size()*tdi_slab_depth;
+    unsigned int slab_count = (geometry.size()+slab_size-1)/slab_size;
+    unsigned int thread_count = std::max<unsigned int>(1,std::thread::hardware_concurrency());
+    typedef std::pair<unsigned int,tipl::vector<3,float> > item_type;
+    slab_buffer<item_type> buffer(slab_count,thread_count);
+    // directional sums are only allocated for the slabs that tracks pass through
+    std::vector<std::vector<tipl::vector<3,float> > > map_rgb(slab_count);
+    auto apply = [&](unsigned int slab,const std::vector<item_type>& list)
+    {
+        auto& m = map_rgb[slab];
+        if(m.empty())
+            m.resize(std::min<unsigned int>(slab_size,geometry.size()-slab*slab_size));
+        for(const auto& each : list)
+            m[each.first-slab*slab_size] += each.second;
+    };
+    tipl::par_for2(tract_data.size(),[&](unsigned int i,unsigned int id)
     {
         const float* buf = &*tract_data[i].begin();
         for (unsigned int j = 3;j < tract_data[i].size();j+=3)
@@ -1654,28 +1847,33 @@ void TractModel::get_density_map(
             if (!geometry.is_valid(x,y,z))
                 continue;
             unsigned int ptr = (z*mapping.height()+y)*mapping.width()+x;
-            map_r[ptr] += std::fabs(dir[0]);
-            map_g[ptr] += std::fabs(dir[1]);
-            map_b[ptr] += std::fabs(dir[2]);
+            buffer.push(id,ptr/slab_size,item_type(ptr,
+                tipl::vector<3,float>(std::fabs(dir[0]),std::fabs(dir[1]),std::fabs(dir[2]))),apply);
         }
-    }
+    },thread_count);
+    buffer.flush(apply);
+
     float max_value = 0.0f;
-    for(unsigned int index = 0;index < mapping.size();++index)
-        max_value = std::max<float>(max_value,map_r[index]+map_g[index]+map_b[index]);
+    for(const auto& m : map_rgb)
+        for(const auto& v : m)
+            max_value = std::max<float>(max_value,v[0]+v[1]+v[2]);
 
-    for(unsigned int index = 0;index < mapping.size();++index)
+    tipl::par_for(slab_count,[&](unsigned int slab)
     {
-        float sum = map_r[index]+map_g[index]+map_b[index];
-        if(sum == 0.0f)
-            continue;
-        tipl::vector<3> v(map_r[index],map_g[index],map_b[index]);
-        sum = v.normalize();
-        v*=255.0*std::log(200.0f*sum/max_value+1)/2.303f;
-        mapping[index] = tipl::rgb(
-                (unsigned char)std::min<float>(255,v[0]),
-                (unsigned char)std::min<float>(255,v[1]),
-                (unsigned char)std::min<float>(255,v[2]));
-    }
+        for(unsigned int i = 0;i < map_rgb[slab].size();++i)
+        {
+            tipl::vector<3> v(map_rgb[slab][i]);
+            float sum = v[0]+v[1]+v[2];
+            if(sum == 0.0f)
+                continue;
+            sum = v.normalize();
+            v*=255.0*std::log(200.0f*sum/max_value+1)/2.303f;
+            mapping[slab*slab_size+i] = tipl::rgb(
+                    (unsigned char)std::min<float>(255,v[0]),
+                    (unsigned char)std::min<float>(255,v[1]),
+                    (unsigned char)std::min<float>(255,v[2]));
+        }
+    });
 }
 
 void TractModel::save_tdi(const char* file_name,bool sub_voxel,bool endpoint,const tipl::matrix<4,4,float>& trans)
@@ -1791,7 +1989,7 @@ void TractModel::get_quantitative_info(std::string& result)
         out << titles[index] << "\t" << data[index] << std::endl;
 
 
-    if(handle->db.has_db()) // connectometry database
+    if(handle->db.has_db() && handle->db.load_subject_qa()) // connectometry database
     {
         std::vector<const float*> old_index_data(fib->other_index[0]);
         for(int i = 0;i < handle->db.num_subjects;++i)
@@ -1816,6 +2014,7 @@ bool TractModel::recognize(std::vector<unsigned int>& result,std::shared_ptr<Tra
     if(tractography_name_list.empty())
         return false;
     result.resize(tract_data.size());
+    atlas->build_index();
     tipl::par_for(tract_data.size(),[&](int i)
     {
         if(tract_data[i].empty())
@@ -1831,6 +2030,7 @@ bool TractModel::recognize(std::map<float,std::string,std::greater<float> >& res
     if(tractography_name_list.empty())
         return false;
     std::vector<float> count(tractography_name_list.size());
+    atlas->build_index();
     tipl::par_for(tract_data.size(),[&](int i)
     {
         if(tract_data[i].empty())
@@ -2086,7 +2286,7 @@ void TractModel::get_tracts_data(unsigned int data_index,float& mean, float& sd)
     }
 }
 
-void TractModel::get_passing_list(const std::vector<std::vector<short> >& region_map,
+void TractModel::get_passing_list(const region_label_map& region_map,
                                   unsigned int region_count,
                                   std::vector<std::vector<short> >& passing_list1,
                                   std::vector<std::vector<short> >& passing_list2) const
@@ -2109,9 +2309,7 @@ void TractModel::get_passing_list(const std::vector<std::vector<short> >& region
                                         std::round(tract_data[index][ptr+2]),geometry);
             if(!geometry.is_valid(pos))
                 continue;
-            unsigned int pos_index = pos.index();
-            for(unsigned int j = 0;j < region_map[pos_index].size();++j)
-                has_region[region_map[pos_index][j]] = 1;
+            region_map.for_each_region(pos.index(),[&](short r){has_region[r] = 1;});
         }
         for(unsigned int i = 0;i < has_region.size();++i)
             if(has_region[i])
@@ -2122,7 +2320,7 @@ void TractModel::get_passing_list(const std::vector<std::vector<short> >& region
     }
 }
 
-void TractModel::get_end_list(const std::vector<std::vector<short> >& region_map,
+void TractModel::get_end_list(const region_label_map& region_map,
                               std::vector<std::vector<short> >& end_pair1,
                               std::vector<std::vector<short> >& end_pair2) const
 {
@@ -2142,8 +2340,8 @@ void TractModel::get_end_list(const std::vector<std::vector<short> >& region_map
                                     std::round(tract_data[index][tract_data[index].size()-1]),geometry);
         if(!geometry.is_valid(end1) || !geometry.is_valid(end2))
             continue;
-        end_pair1[index] = region_map[end1.index()];
-        end_pair2[index] = region_map[end2.index()];
+        region_map.get_regions(end1.index(),end_pair1[index]);
+        region_map.get_regions(end2.index(),end_pair2[index]);
     }
 }
 
@@ -2260,64 +2458,62 @@ void ConnectivityMatrix::set_regions(const tipl::geometry<3>& geo,
 {
     region_count = regions.size();
 
-    region_map.clear();
-    region_map.resize(geo.size());
+    std::shared_ptr<region_label_map> new_map(std::make_shared<region_label_map>());
+    region_label_map& map = *new_map;
+    map.label.resize(geo.size(),-1);
 
-    std::vector<std::set<short> > regions_set(geo.size());
+    // regions are visited in ascending order, so each overlap list stays sorted
+    unsigned int total_count = 0;
     for(unsigned int roi = 0;roi < region_count;++roi)
     {
         for(unsigned int index = 0;index < regions[roi].size();++index)
         {
             tipl::vector<3,short> pos = regions[roi][index];
-            if(geo.is_valid(pos))
-                regions_set[tipl::pixel_index<3>(pos[0],pos[1],pos[2],geo).index()].insert(roi);
+            if(!geo.is_valid(pos))
+                continue;
+            int& l = map.label[tipl::pixel_index<3>(pos[0],pos[1],pos[2],geo).index()];
+            if(l == -1)
+            {
+                l = roi;
+                ++total_count;
+                continue;
+            }
+            if(l == int(roi))
+                continue;
+            if(l >= 0)
+            {
+                map.overlap.push_back(std::vector<short>{short(l),short(roi)});
+                l = -1-int(map.overlap.size());
+                continue;
+            }
+            std::vector<short>& list = map.overlap[size_t(-2-l)];
+            if(list.back() != short(roi))
+                list.push_back(roi);
         }
     }
-    unsigned int overlap_count = 0,total_count = 0;
-    for(unsigned int index = 0;index < geo.size();++index)
-        if(!regions_set[index].empty())
-        {
-            for(auto i : regions_set[index])
-                region_map[index].push_back(i);
-            ++total_count;
-            if(region_map[index].size() > 1)
-                ++overlap_count;
-        }
-    overlap_ratio = (float)overlap_count/(float)total_count;
+    overlap_ratio = total_count ? float(map.overlap.size())/float(total_count) : 0.0f;
+    region_map = new_map;
     atlas_name = "roi";
 }
 
-void ConnectivityMatrix::set_atlas(std::shared_ptr<atlas> data,const tipl::image<tipl::vector<3,float>,3 >& mni_position)
+void ConnectivityMatrix::set_atlas(std::shared_ptr<atlas> data,std::shared_ptr<fib_data> handle)
 {
-    if(mni_position.empty())
-        return;
-    tipl::geometry<3> geo(mni_position.geometry());
-    tipl::vector<3> null;
     region_count = data->get_list().size();
     region_name.clear();
     for (unsigned int label_index = 0; label_index < region_count; ++label_index)
         region_name.push_back(data->get_list()[label_index]);
-    data->is_labeled_as(mni_position.front(),0);// trigger load from file
-
-    region_map.clear();
-    region_map.resize(geo.size());
-    for(int i = 0;i < region_count;++i)
+    region_map.reset();
+    auto label_map = handle->get_atlas_label_map(data);
+    if(!label_map)
     {
-        mni_position.for_each_mt([&](const tipl::vector<3,float>& mni,const tipl::pixel_index<3>& index)
-        {
-            if(mni != null && data->is_labeled_as(mni,i))
-                region_map[index.index()].push_back(i);
-        });
+        region_count = 0;
+        error_msg = handle->error_msg;
+        return;
     }
-    unsigned int overlap_count = 0,total_count = 0;
-    for(unsigned int index = 0;index < geo.size();++index)
-        if(!region_map[index].empty())
-        {
-            ++total_count;
-            if(region_map[index].size() > 1)
-                ++overlap_count;
-        }
-    overlap_ratio = (float)overlap_count/(float)total_count;
+    // the cached map is shared, not copied
+    region_map = label_map;
+    unsigned int total_count = region_map->label.size()-std::count(region_map->label.begin(),region_map->label.end(),-1);
+    overlap_ratio = total_count ? float(region_map->overlap.size())/float(total_count) : 0.0f;
     atlas_name = data->name;
 }
 
@@ -2351,7 +2547,7 @@ void for_each_connectivity(const T& end_list1,
 
 bool ConnectivityMatrix::calculate(TractModel& tract_model,std::string matrix_value_type,bool use_end_only,float threshold)
 {
-    if(region_count == 0)
+    if(region_count == 0 || !region_map)
     {
         error_msg = "No region information. Please assign regions";
         return false;
@@ -2359,9 +2555,9 @@ bool ConnectivityMatrix::calculate(TractModel& tract_model,std::string matrix_va
 
     std::vector<std::vector<short> > end_list1,end_list2;
     if(use_end_only)
-        tract_model.get_end_list(region_map,end_list1,end_list2);
+        tract_model.get_end_list(*region_map,end_list1,end_list2);
     else
-        tract_model.get_passing_list(region_map,region_count,end_list1,end_list2);
+        tract_model.get_passing_list(*region_map,region_count,end_list1,end_list2);
     if(matrix_value_type == "trk")
     {
         std::vector<std::vector<std::vector<unsigned int> > > region_passing_list;
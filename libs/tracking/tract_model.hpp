@@ -4,6 +4,8 @@
 #include <iosfwd>
 #include "tipl/tipl.hpp"
 #include "fib_data.hpp"
+#include "tract_index.hpp"
+#include "tract_arena.hpp"
 
 class RoiMgr;
 class TractModel{
@@ -15,8 +17,9 @@ private:
         tipl::vector<3> vs;
         std::shared_ptr<tracking_data> fib;
 private:
-        std::vector<std::vector<float> > tract_data;
-        std::vector<std::vector<float> > deleted_tract_data;
+        tract_arena tract_data;
+        // deleted tracts stay in tract_data until clear_deleted
+        std::vector<unsigned int> deleted_tract_id;
         std::vector<unsigned int> tract_color;
         std::vector<unsigned int> tract_tag;
         std::vector<unsigned int> deleted_tract_color;
@@ -26,10 +29,14 @@ private:
         unsigned int cur_cut_id = 1;
         std::vector<std::pair<unsigned int,unsigned int> > redo_size;
         // offset, size
+        void erase_tracts(std::vector<char>& erased);
         void erase_empty(void);
 private:
         // for loading multiple clusters
         std::vector<unsigned int> tract_cluster;
+private:
+        // for find_nearest
+        std::shared_ptr<tract_index> nearest_index;
 public:
         static bool save_all(const char* file_name,const std::vector<std::shared_ptr<TractModel> >& all);
         const std::vector<unsigned int>& get_cluster_info(void) const{return tract_cluster;}
@@ -43,6 +50,7 @@ public:
         void delete_repeated(double d);
         void delete_by_length(float length);
         unsigned int find_nearest(const float* trk,unsigned int length,bool contain = false);
+        void build_index(void);
 
 public:
         TractModel(std::shared_ptr<fib_data> handle_);
@@ -51,10 +59,18 @@ public:
             geometry = rhs.geometry;
             vs = rhs.vs;
             handle = rhs.handle;
-            tract_data = rhs.tract_data;
+            tract_data.clear();
+            tract_data.append(rhs.tract_data);
+            deleted_tract_id.clear();
+            deleted_tract_color.clear();
+            deleted_tract_tag.clear();
+            deleted_count.clear();
+            is_cut.clear();
+            redo_size.clear();
             tract_color = rhs.tract_color;
             tract_tag = rhs.tract_tag;
             report = rhs.report;
+            nearest_index.reset();
             return *this;
         }
         std::shared_ptr<fib_data> get_handle(void){return handle;}
@@ -80,9 +96,12 @@ public:
 
 
         void release_tracts(std::vector<std::vector<float> >& released_tracks);
+        void release_tracts(tract_arena& released_tracks);
         void add_tracts(std::vector<std::vector<float> >& new_tracks);
         void add_tracts(std::vector<std::vector<float> >& new_tracks,tipl::rgb color);
-        void add_tracts(std::vector<std::vector<float> >& new_tracks,unsigned int length_threshold);
+        void add_tracts(tract_arena& new_tracks);
+        void add_tracts(tract_arena& new_tracks,tipl::rgb color);
+        void add_tracts(tract_arena& new_tracks,unsigned int length_threshold);
         void filter_by_roi(std::shared_ptr<RoiMgr> roi_mgr);
         void cull(float select_angle,
                   const std::vector<tipl::vector<3,float> > & dirs,
@@ -107,13 +126,13 @@ public:
         void get_end_points(std::vector<tipl::vector<3,float> >& points);
         void get_tract_points(std::vector<tipl::vector<3,float> >& points);
 
-        size_t get_deleted_track_count(void) const{return deleted_tract_data.size();}
+        size_t get_deleted_track_count(void) const{return deleted_tract_id.size();}
         size_t get_visible_track_count(void) const{return tract_data.size();}
         
-        const std::vector<float>& get_tract(unsigned int index) const{return tract_data[index];}
-        const std::vector<std::vector<float> >& get_tracts(void) const{return tract_data;}
-        const std::vector<std::vector<float> >& get_deleted_tracts(void) const{return deleted_tract_data;}
-        std::vector<std::vector<float> >& get_tracts(void) {return tract_data;}
+        tract_span<const float> get_tract(unsigned int index) const{return tract_data[index];}
+        const tract_arena& get_tracts(void) const{return tract_data;}
+        tract_arena& get_tracts(void) {return tract_data;}
+        void get_deleted_tracts(tract_arena& tracts) const;
         unsigned int get_tract_color(unsigned int index) const{return tract_color[index];}
         size_t get_tract_length(unsigned int index) const{return tract_data[index].size();}
         void get_density_map(tipl::image<unsigned int,3>& mapping,
@@ -143,11 +162,11 @@ public:
         void get_tracts_data(unsigned int index_num,float& mean, float& sd) const;
 public:
 
-        void get_passing_list(const std::vector<std::vector<short> >& region_map,
+        void get_passing_list(const region_label_map& region_map,
                               unsigned int region_count,
                                      std::vector<std::vector<short> >& passing_list1,
                                      std::vector<std::vector<short> >& passing_list2) const;
-        void get_end_list(const std::vector<std::vector<short> >& region_map,
+        void get_end_list(const region_label_map& region_map,
                                      std::vector<std::vector<short> >& end_list1,
                                      std::vector<std::vector<short> >& end_list2) const;
         void run_clustering(unsigned char method_id,unsigned int cluster_count,float param);
@@ -163,12 +182,12 @@ public:
 
     tipl::image<float,2> matrix_value;
 public:
-    std::vector<std::vector<short> > region_map;
+    std::shared_ptr<const region_label_map> region_map;
     unsigned int region_count;
     std::vector<std::string> region_name;
     std::string error_msg,atlas_name;
     float overlap_ratio;
-    void set_atlas(std::shared_ptr<atlas> data,const tipl::image<tipl::vector<3,float>,3 >& mni_position);
+    void set_atlas(std::shared_ptr<atlas> data,std::shared_ptr<fib_data> handle);
     void set_regions(const tipl::geometry<3>& geo,
                      const std::vector<std::vector<tipl::vector<3,short> > >& regions);
 public:
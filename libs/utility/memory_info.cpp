@@ -0,0 +1,67 @@
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#include "memory_info.hpp"
+
+#ifdef __linux__
+// reads a "key: value kB" entry of a /proc file in bytes, or 0 if not found
+size_t read_proc_memory(const std::string& file_name,const char* key)
+{
+    std::ifstream in(file_name.c_str());
+    std::string line;
+    size_t key_length = std::strlen(key);
+    while(std::getline(in,line))
+        if(line.compare(0,key_length,key) == 0)
+            return size_t(std::atoll(line.c_str()+key_length))*1024;
+    return 0;
+}
+#endif
+// MemAvailable includes the page cache that can be reclaimed, which MemFree leaves out.
+// On macOS the inactive pages are counted for the same reason.
+size_t get_available_memory(void)
+{
+#ifdef __linux__
+    size_t available = read_proc_memory("/proc/meminfo","MemAvailable:");
+    if(available)
+        return available;
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if(pages > 0 && page_size > 0)
+        return size_t(pages)*size_t(page_size);
+#endif
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if(GlobalMemoryStatusEx(&status))
+        return size_t(status.ullAvailPhys);
+#endif
+#ifdef __APPLE__
+    vm_statistics64_data_t vm_stat;
+    mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+    vm_size_t page_size = 0;
+    mach_port_t host = mach_host_self();
+    if(host_page_size(host,&page_size) == KERN_SUCCESS &&
+       host_statistics64(host,HOST_VM_INFO64,reinterpret_cast<host_info64_t>(&vm_stat),&count) == KERN_SUCCESS)
+        return size_t(vm_stat.free_count+vm_stat.inactive_count)*size_t(page_size);
+#endif
+    return 0;
+}
+// only read on Linux: elsewhere the callers fall back to their own estimate
+size_t get_process_memory(long long pid)
+{
+#ifdef __linux__
+    return read_proc_memory("/proc/" + std::to_string(pid) + "/status","VmRSS:");
+#endif
+    (void)pid;
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef MEMORY_INFO_HPP
+#define MEMORY_INFO_HPP
+#include <cstddef>
+// available physical memory in bytes, or 0 if it cannot be determined
+size_t get_available_memory(void);
+// resident memory of a process in bytes, or 0 if it cannot be determined
+size_t get_process_memory(long long pid);
+#endif//MEMORY_INFO_HPP
@@ -2,13 +2,19 @@
 #include <iterator>
 #include <string>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <QApplication>
 #include <QMessageBox>
 #include <QStyleFactory>
 #include <QDir>
+#include <QProcess>
+#include <thread>
 #include "mainwindow.h"
 #include "tipl/tipl.hpp"
 #include "mapping/atlas.hpp"
+#include "utility/memory_info.hpp"
 #include <iostream>
 #include <iterator>
 #include "program_option.hpp"
@@ -221,6 +227,99 @@ int run_action(std::shared_ptr<QApplication> gui)
     return 1;
 }
 
+// Runs each file of a wildcard --source in a child process, --parallel jobs at
+// a time. The threads are split evenly across the jobs unless --thread_count
+// is given, and the output of each job goes to <file>.log.
+int run_batch(const QStringList& file_list,int ac, char *av[],unsigned int job_count)
+{
+    // a job is assumed to need this many times the size of its (compressed) source file
+    const size_t memory_per_file_size = 10;
+    QStringList base_args;
+    bool has_thread_count = false;
+    for (int i = 1; i < ac; ++i)
+    {
+        std::string arg(av[i]);
+        if(arg.find("--source=") == 0 || arg.find("--parallel=") == 0)
+            continue;
+        if(arg.find("--thread_count=") == 0)
+            has_thread_count = true;
+        base_args << av[i];
+    }
+    if(!has_thread_count)
+        base_args << QString("--thread_count=%1").arg(
+                         std::max<unsigned int>(1,std::thread::hardware_concurrency()/job_count));
+
+    struct job_type{
+        QString file_name;
+        size_t memory;
+        std::shared_ptr<QProcess> process;
+    };
+    std::vector<job_type> running;
+    std::vector<std::string> failed;
+    int next = 0;
+    std::cout << "run " << file_list.size() << " files with " << job_count << " parallel jobs" << std::endl;
+    while(next < file_list.size() || !running.empty())
+    {
+        // admit jobs while there are free slots and enough memory for the next one
+        while(next < file_list.size() && running.size() < job_count)
+        {
+            job_type job;
+            job.file_name = QDir::current().absoluteFilePath(file_list[next]);
+            job.memory = size_t(QFileInfo(job.file_name).size())*memory_per_file_size;
+            size_t available = get_available_memory();
+            // the available memory already excludes what the running jobs use,
+            // so reserve only the part of their estimate they have not allocated yet
+            size_t reserved_memory = 0;
+            for(const auto& each : running)
+            {
+                size_t used = get_process_memory(each.process->processId());
+                if(used < each.memory)
+                    reserved_memory += each.memory-used;
+            }
+            if(!running.empty() && available &&
+               (available < reserved_memory || available-reserved_memory < job.memory))
+                break;
+            job.process = std::make_shared<QProcess>();
+            job.process->setProcessChannelMode(QProcess::MergedChannels);
+            job.process->setStandardOutputFile(job.file_name + ".log");
+            job.process->start(QCoreApplication::applicationFilePath(),
+                               QStringList(base_args) << QString("--source=") + job.file_name);
+            ++next;
+            if(!job.process->waitForStarted())
+            {
+                std::cout << "failed to start:" << job.file_name.toStdString() << std::endl;
+                failed.push_back(job.file_name.toStdString());
+                continue;
+            }
+            std::cout << "Process file:" << job.file_name.toStdString() << std::endl;
+            running.push_back(job);
+        }
+        for(size_t i = 0;i < running.size();)
+        {
+            if(!running[i].process->waitForFinished(50) &&
+                running[i].process->state() != QProcess::NotRunning)
+            {
+                ++i;
+                continue;
+            }
+            bool success = running[i].process->exitStatus() == QProcess::NormalExit &&
+                           running[i].process->exitCode() == 0;
+            std::cout << (success ? "finished:" : "failed:") << running[i].file_name.toStdString() << std::endl;
+            if(!success)
+                failed.push_back(running[i].file_name.toStdString());
+            running.erase(running.begin()+i);
+        }
+    }
+    std::cout << "=======================================" << std::endl;
+    std::cout << file_list.size()-failed.size() << " of " << file_list.size() << " files completed." << std::endl;
+    if(failed.empty())
+        return 0;
+    std::cout << "failed files (see the .log file of each):" << std::endl;
+    for(const auto& name : failed)
+        std::cout << name << std::endl;
+    return 1;
+}
+
 int run_cmd(int ac, char *av[])
 {
     try
@@ -267,6 +366,12 @@ int run_cmd(int ac, char *av[])
         {
             auto file_list = QDir::current().entryList(QStringList(QFileInfo(po.get("source").c_str()).fileName()),
                                             QDir::Files|QDir::NoSymLinks);
+            int job_count = po.get("parallel",1);
+            if(job_count > 1)
+            {
+                po.set_all_used(); // the options are checked by each job
+                return run_batch(file_list,ac,av,job_count);
+            }
             for (unsigned int index = 0;index < file_list.size();++index)
             {
                 QString filename = QDir::current().absoluteFilePath(file_list[index]);
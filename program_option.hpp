@@ -82,6 +82,10 @@ public:
         return false;
     }
 
+    void set_all_used(void)
+    {
+        std::fill(used.begin(),used.end(),1);
+    }
     void set(const char* name,const std::string& value)
     {
         names.push_back(name);
@@ -119,7 +119,7 @@ void connectivity_matrix_dialog::on_recalculate_clicked()
         {
             if(!cur_tracking_window->handle->load_atlas())
                 return;
-            data.set_atlas(cur_tracking_window->handle->atlas_list[ui->region_list->currentIndex()-1],cur_tracking_window->handle->get_mni_mapping());
+            data.set_atlas(cur_tracking_window->handle->atlas_list[ui->region_list->currentIndex()-1],cur_tracking_window->handle);
         }
 
     TractModel tracks(cur_tracking_window->handle);
@@ -453,7 +453,26 @@ void calculate_region_stat(const Image& I, const Points& p,float& mean,float& sd
     sd = std::sqrt(std::max<float>(0.0,sum2-sum*sum));
 }
 
-void ROIRegion::get_quantitative_data(std::shared_ptr<fib_data> handle,std::vector<std::string>& titles,std::vector<float>& data)
+void ROIRegion::get_fib_points(std::vector<tipl::vector<3> >& points) const
+{
+    points.clear();
+    for (unsigned int index = 0; index < region.size(); ++index)
+        points.push_back(tipl::vector<3>(region[index][0]/resolution_ratio,
+                                          region[index][1]/resolution_ratio,
+                                          region[index][2]/resolution_ratio));
+}
+void get_db_titles(std::shared_ptr<fib_data> handle,std::vector<std::string>& titles)
+{
+    for(unsigned int subject_index = 0;subject_index < handle->db.num_subjects;++subject_index)
+    {
+        std::ostringstream out1,out2;
+        out1 << handle->db.subject_names[subject_index] << " " << handle->db.index_name << " mean";
+        out2 << handle->db.subject_names[subject_index] << " " << handle->db.index_name << " sd";
+        titles.push_back(out1.str());
+        titles.push_back(out2.str());
+    }
+}
+void ROIRegion::get_quantitative_data(std::shared_ptr<fib_data> handle,std::vector<std::string>& titles,std::vector<float>& data,bool with_db)
 {
     titles.clear();
     titles.push_back("voxel counts");
@@ -493,10 +512,7 @@ void ROIRegion::get_quantitative_data(std::shared_ptr<fib_data> handle,std::vect
 
     handle->get_index_titles(titles); // other index
     std::vector<tipl::vector<3> > points;
-    for (unsigned int index = 0; index < region.size(); ++index)
-        points.push_back(tipl::vector<3>(region[index][0]/resolution_ratio,
-                                          region[index][1]/resolution_ratio,
-                                          region[index][2]/resolution_ratio));
+    get_fib_points(points);
 
 
     for(int data_index = 0;data_index < handle->view_item.size(); ++data_index)
@@ -512,24 +528,36 @@ void ROIRegion::get_quantitative_data(std::shared_ptr<fib_data> handle,std::vect
         data.push_back(sd);
     }
 
-    if(handle->db.has_db()) // connectometry database
+    if(with_db && handle->db.has_db() && handle->db.load_subject_qa()) // connectometry database
     {
-        for(unsigned int subject_index = 0;subject_index < handle->db.num_subjects;++subject_index)
-        {
-            std::vector<std::vector<float> > fa_data;
-            handle->db.get_subject_fa(subject_index,fa_data);
-            float mean,sd;
-            tipl::const_pointer_image<float, 3> I(&fa_data[0][0],handle->dim);
-            calculate_region_stat(I,points,mean,sd);
-            data.push_back(mean);
-            data.push_back(sd);
-
-            std::ostringstream out1,out2;
-            out1 << handle->db.subject_names[subject_index] << " " << handle->db.index_name << " mean";
-            out2 << handle->db.subject_names[subject_index] << " " << handle->db.index_name << " sd";
-            titles.push_back(out1.str());
-            titles.push_back(out2.str());
-
-        }
+        std::vector<std::vector<float> > db_data;
+        handle->db.get_region_stat(std::vector<std::vector<tipl::vector<3> > >(1,points),db_data);
+        data.insert(data.end(),db_data[0].begin(),db_data[0].end());
+        get_db_titles(handle,titles);
     }
 }
+void get_regions_quantitative_data(std::shared_ptr<fib_data> handle,
+                                   const std::vector<std::shared_ptr<ROIRegion> >& regions,
+                                   std::vector<std::string>& titles,
+                                   std::vector<std::vector<float> >& data)
+{
+    data.clear();
+    data.resize(regions.size());
+    tipl::par_for(regions.size(),[&](unsigned int index){
+        std::vector<std::string> dummy;
+        regions[index]->get_quantitative_data(handle,(index == 0) ? titles : dummy,data[index],false);
+    });
+    if(regions.empty() || !handle->db.has_db() || !handle->db.load_subject_qa())
+        return;
+    // empty regions have no index statistics and get no database statistics either
+    std::vector<std::vector<tipl::vector<3> > > points(regions.size());
+    for(unsigned int index = 0;index < regions.size();++index)
+        regions[index]->get_fib_points(points[index]);
+    std::vector<std::vector<float> > db_data;
+    handle->db.get_region_stat(points,db_data);
+    for(unsigned int index = 0;index < regions.size();++index)
+        if(!regions[index]->region.empty())
+            data[index].insert(data[index].end(),db_data[index].begin(),db_data[index].end());
+    if(!regions[0]->region.empty())
+        get_db_titles(handle,titles);
+}
@@ -254,7 +254,13 @@ public:
                     return true;
             return false;
         }
-        void get_quantitative_data(std::shared_ptr<fib_data> handle,std::vector<std::string>& titles,std::vector<float>& data);
+        void get_fib_points(std::vector<tipl::vector<3> >& points) const;
+        void get_quantitative_data(std::shared_ptr<fib_data> handle,std::vector<std::string>& titles,std::vector<float>& data,bool with_db = true);
 };
+// get_quantitative_data of all regions, with the database statistics of all regions from one pass over the subjects
+void get_regions_quantitative_data(std::shared_ptr<fib_data> handle,
+                                   const std::vector<std::shared_ptr<ROIRegion> >& regions,
+                                   std::vector<std::string>& titles,
+                                   std::vector<std::vector<float> >& data);
 
 #endif
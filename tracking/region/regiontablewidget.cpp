@@ -1030,11 +1030,8 @@ void get_regions_statistics(std::shared_ptr<fib_data> handle,
                             std::string& result)
 {
     std::vector<std::string> titles;
-    std::vector<std::vector<float> > data(regions.size());
-    tipl::par_for(regions.size(),[&](unsigned int index){
-        std::vector<std::string> dummy;
-        regions[index]->get_quantitative_data(handle,(index == 0) ? titles : dummy,data[index]);
-    });
+    std::vector<std::vector<float> > data;
+    get_regions_quantitative_data(handle,regions,titles,data);
     std::ostringstream out;
     out << "Name\t";
     for(unsigned int index = 0;index < regions.size();++index)
@@ -1366,7 +1363,7 @@ void RegionTableWidget::do_action(QString action)
                 std::vector<std::vector<float> > data(regions.size());
                 tipl::par_for(regions.size(),[&](unsigned int index){
                     std::vector<std::string> dummy;
-                    regions[index]->get_quantitative_data(cur_tracking_window.handle,dummy,data[index]);
+                    regions[index]->get_quantitative_data(cur_tracking_window.handle,dummy,data[index],false);
                 });
                 size_t comp_index = 0; // sort_size
                 if(action == "sort_x")
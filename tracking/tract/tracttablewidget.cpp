@@ -398,7 +398,7 @@ void TractTableWidget::assign_colors(void)
 }
 void TractTableWidget::load_cluster_label(const std::vector<unsigned int>& labels,QStringList Names)
 {
-    std::vector<std::vector<float> > tracts;
+    tract_arena tracts;
     tract_models[currentRow()]->release_tracts(tracts);
     delete_row(currentRow());
     unsigned int cluster_num = *std::max_element(labels.begin(),labels.end());
@@ -407,13 +407,11 @@ void TractTableWidget::load_cluster_label(const std::vector<unsigned int>& label
         unsigned int fiber_num = std::count(labels.begin(),labels.end(),cluster_index);
         if(!fiber_num)
             continue;
-        std::vector<std::vector<float> > add_tracts(fiber_num);
-        for(unsigned int index = 0,i = 0;index < labels.size();++index)
+        tract_arena add_tracts;
+        add_tracts.reserve(fiber_num,0);
+        for(unsigned int index = 0;index < labels.size();++index)
             if(labels[index] == cluster_index)
-            {
-                add_tracts[i].swap(tracts[index]);
-                ++i;
-            }
+                add_tracts.push_back(tracts[index]);
         if(cluster_index < Names.size())
             addNewTracts(Names[cluster_index],false);
         else
@@ -650,7 +648,7 @@ void TractTableWidget::deep_learning_train(void)
             tipl::image<unsigned char,3> track_map(cur_tracking_window.handle->dim);
             for(unsigned int i = 0;i < tract_models[index]->get_tracts().size();++i)
             {
-                const std::vector<float>& tracks = tract_models[index]->get_tracts()[i];
+                auto tracks = tract_models[index]->get_tracts()[i];
                 for(int j = 0;j < tracks.size();j += 3)
                 {
                     tipl::pixel_index<3> p(std::round(tracks[j]),std::round(tracks[j+1]),std::round(tracks[j+2]),track_map.geometry());
@@ -734,23 +732,24 @@ void TractTableWidget::saveTransformedTracts(const float* transform)
         tract_models[currentRow()]->save_transformed_tracts_to_file(&*sfilename.begin(),transform,false);
     else
     {
-        std::vector<std::vector<float> > tract_data(tract_models[currentRow()]->get_tracts());
+        tract_arena tract_data(tract_models[currentRow()]->get_tracts());
         begin_prog("converting coordinates");
         for(unsigned int i = 0;check_prog(i,tract_data.size());++i)
         {
-            for(unsigned int j = 0;j < tract_data[i].size();j += 3)
+            auto t = tract_data[i];
+            for(unsigned int j = 0;j < t.size();j += 3)
             {
-                tipl::vector<3> v(&(tract_data[i][j]));
+                tipl::vector<3> v(&(t[j]));
                 cur_tracking_window.handle->subject2mni(v);
-                tract_data[i][j] = v[0];
-                tract_data[i][j+1] = v[1];
-                tract_data[i][j+2] = v[2];
+                t[j] = v[0];
+                t[j+1] = v[1];
+                t[j+2] = v[2];
             }
             if(!cur_tracking_window.handle->is_qsdr)
             {
                 std::vector<float> smooth_track;
-                smoothed_tracks(tract_data[i],smooth_track);
-                tract_data[i].swap(smooth_track);
+                smoothed_tracks(t,smooth_track);
+                tract_data.replace(i,smooth_track.data(),smooth_track.size());
             }
         }
         if(!prog_aborted())
@@ -1021,7 +1020,8 @@ void TractTableWidget::separate_deleted_track(void)
 {
     unsigned int cur_row = currentRow();
     addNewTracts(item(cur_row,0)->text(),false);
-    std::vector<std::vector<float> > new_tracks = tract_models[cur_row]->get_deleted_tracts();
+    tract_arena new_tracks;
+    tract_models[cur_row]->get_deleted_tracts(new_tracks);
     if(new_tracks.empty())
         return;
     tract_models.back()->add_tracts(new_tracks);